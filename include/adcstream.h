@@ -0,0 +1,39 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _ADCSTREAM_H
+#define _ADCSTREAM_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define ADC_STREAM_CHANNELS 8  // ADC1 only, ADC2 is used by WiFi
+#define ADC_STREAM_FREQ_HZ 20000  // lowest conversion rate on ESP32
+#define ADC_STREAM_BLOCK 64  // raw samples averaged per ring entry
+#define ADC_STREAM_SAMPLES 64  // ring entries per channel
+#define ADC_STREAM_READ_BYTES 256
+
+bool adcStreamBegin(const int8_t* pins, uint8_t n);
+void adcStreamEnd();
+void adcStreamPoll();
+bool adcStreaming(int8_t pin);
+int16_t adcStreamValue(int8_t pin, uint8_t blocks);
+
+#endif
@@ -102,6 +102,83 @@
 #define MOISTURE_VALUE_AIR 840
 #define MOISTURE_VALUE_WATER 445
 
+// filters applied to sensor readings (window max. 9 readings):
+// FILTER_MEAN (moving average), FILTER_MEDIAN, FILTER_TRIMMED (mean 
+// without lowest and highest quarter), FILTER_EMA (exponential 
+// smoothing) or FILTER_HAMPEL (replaces outliers by median);
+// moisture readings are only filtered if enabled on settings page,
+// MOISTn_FILTER selects the filter of each moisture sensor
+#define MOISTURE_FILTER FILTER_TRIMMED
+#define MOISTURE_FILTER_SIZE 5
+#define MOIST1_FILTER MOISTURE_FILTER
+#define MOIST2_FILTER MOISTURE_FILTER
+#define MOIST3_FILTER MOISTURE_FILTER
+#define MOIST4_FILTER MOISTURE_FILTER
+#define WATER_LEVEL_FILTER FILTER_HAMPEL
+#define WATER_LEVEL_FILTER_SIZE 5
+
+// sensors are sampled by a separate task pinned to the core not
+// running the main loop (WiFi also runs on core 0 at higher priority)
+#define SENSOR_TASK_CORE 0
+#define SENSOR_TASK_PRIO 1
+#define SENSOR_TASK_STACK 4096
+#define SENSOR_TASK_TICK_MS 10
+#define SENSOR_REPORT_SECS 15  // print latest readings
+
+// adaptive sampling: sensors are sampled at the active rate while
+// pump or valves are on; once idle the interval doubles with every
+// sample up to the idle limit; the continuous ADC stream is only 
+// running while active or shortly before a moisture sample is due
+#define WATER_LEVEL_ACTIVE_MS 1000
+#define WATER_LEVEL_IDLE_MS 300000
+#define MOISTURE_ACTIVE_MS 5000
+#define MOISTURE_IDLE_MS 600000
+#define TEMP_ACTIVE_MS 15000
+#define TEMP_IDLE_MS 600000
+#define ADC_WARMUP_MS 2000
+
+// sample moisture sensors (and pump current) continuously using
+// the ADC1 digital controller (DMA) instead of blocking analogRead()
+// calls, readings are averaged over the last second or so
+#define ADC_CONTINUOUS
+
+// optional concurrent irrigation: flow demand of each valve and
+// capacity of the pump (l/min); irrigation programs open valves
+// at the same time as long as their total flow fits the pump,
+// PUMP_CAPACITY 0 opens one valve at a time to keep up pressure
+// valves with flow demand 0 always run on their own
+#define PUMP_CAPACITY 0
+#define RELAY1_FLOW 0
+#define RELAY2_FLOW 0
+#define RELAY3_FLOW 0
+#define RELAY4_FLOW 0
+
+// measured flow of each valve (l/min), only used to report water 
+// usage; valves without a rate report run time only
+#define RELAY1_RATE 0
+#define RELAY2_RATE 0
+#define RELAY3_RATE 0
+#define RELAY4_RATE 0
+
+// pause between consecutive zones of an irrigation program; the
+// pump keeps running for PUMP_HANDOVER_SECS after a valve closed if
+// the next valve opens within that time, so with a handover time
+// longer than the zone gap one program run needs only one pump start
+// (0 stops the pump between zones); meanwhile the pump runs against
+// closed valves (dead-heading), the pump current monitor is paused
+// until the next valve opens
+#define ZONE_GAP_SECS 5
+#ifndef PUMP_HANDOVER_SECS
+#define PUMP_HANDOVER_SECS 0
+#endif
+
+// manual relay commands (web ui, mqtt) are held for given ms so that
+// rapid on/off toggles cancel out; valves and pump stay on or off for
+// at least RELAY_MIN_ON_MS/RELAY_MIN_OFF_MS to reduce wear and pressure hammer
+#define RELAY_COMMAND_WINDOW_MS 500
+#define RELAY_MIN_ON_MS 5000
+#define RELAY_MIN_OFF_MS 5000
+
 // wait a least given number of secs before triggering 
 // relay again; meant to prevent accidental overwatering
 #define RELAY_BLOCK_MINS 180
@@ -113,17 +190,57 @@
 #define US_TRIGGER_PIN 12
 #define US_ECHO_PIN 14
 
+// optional pump current sensor (ACS712 or similar) on ADC1, pump and
+// valves are locked out like on low water if the pump runs dry, a line 
+// is clogged or the pump stalls; ADC reading at zero current and current
+// per ADC step depend on sensor type and voltage divider, both refer to
+// readings at PUMP_CURRENT_ADC_BITS
+//#define PUMP_CURRENT_PIN 35
+#define PUMP_CURRENT_ADC_BITS 12
+#define PUMP_CURRENT_ADC_ZERO 2048
+#define PUMP_CURRENT_UA_PER_STEP 4300
+#define PUMP_CURRENT_DRY_MA 600
+#define PUMP_CURRENT_CLOG_MA 1600
+#define PUMP_CURRENT_STALL_MA 3000
+#define PUMP_CURRENT_NONE_MA 100
+#define PUMP_CURRENT_SAMPLE_MS 50
+#define PUMP_CURRENT_STARTUP_MS 500
+#define PUMP_CURRENT_FAULT_MS 750
+#define PUMP_CURRENT_STALL_MS 200
+#define PUMP_FAULT_LOCKOUT_MINS 30
+
 // log sensor reading to flash
 #define ENABLE_LOGGING
 
 // if plants haven't been watered for AUTO_IRRIGATION_PAUSE_HOURS trigger 
 // irrigation (all valves) for AUTO_IRRIGATION_SECS at AUTO_IRRIGRATION_TIME
+// on given weekdays (bit 0 = sunday ... bit 6 = saturday)
 // Note: AUTO_IRRIGATION_DURATION_SECS must be less than PUMP_AUTOSTOP_SECS
+// Further programs with up to 4 start times can be set in the web interface
 #define ENABLE_AUTO_IRRIGRATION
 #define AUTO_IRRIGRATION_TIME "06:30"   // HH:MM, 24h
+#define AUTO_IRRIGATION_WEEKDAYS 0x7F   // every day
 #define AUTO_IRRIGATION_SECS 20
 #define AUTO_IRRIGATION_PAUSE_HOURS 18
 
+// use hierarchical timing wheel instead of binary heap for
+// scheduled valve jobs; O(1) insert and expiry, but scheduler passes
+// cost more than with the heap, which stays faster up to a few hundred
+// pending jobs (compare env:native_bench and env:native_bench_wheel)
+//#define SCHEDULER_TIMING_WHEEL
+//#define MAX_JOBS 1024
+
+// pending valve jobs are journaled in RTC memory; after an unexpected 
+// reset (watchdog, exception, brownout) interrupted irrigation is resumed
+// if the system was down for less then given number of seconds
+#define JOURNAL_RESUME_SECS 120
+
+// additionally keep journal in NVS to survive a power loss
+// (more flash writes, one on every valve or job change and
+// a heartbeat every JOURNAL_NVS_ALIVE_SECS while busy)
+//#define JOURNAL_NVS
+#define JOURNAL_NVS_ALIVE_SECS 60
+
 // time server
 #define NTP_ADDRESS "de.pool.ntp.org"
 
@@ -134,4 +251,7 @@
 // prints free heap in web ui
 //#define DEBUG_MEMORY
 
+// verify relay interlocks whenever relays are switched
+//#define DEBUG_INTERLOCKS
+
 #endif
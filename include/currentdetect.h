@@ -0,0 +1,60 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _CURRENTDETECT_H
+#define _CURRENTDETECT_H
+
+#include <stdint.h>
+
+// streaming detector for pump current faults, fed with one sample
+// (mA) at a time; doesn't depend on hardware so it can be run
+// against recorded or synthetic current traces on the host
+typedef enum {
+    CURRENT_OK,
+    CURRENT_DRY,  // current too low, pump running dry
+    CURRENT_CLOG,  // current too high, clogged line
+    CURRENT_STALL,  // locked rotor or no current at all
+    CURRENT_FAULTS
+} currentfault_t;
+
+typedef struct {
+    uint16_t dryMA;  // current at or below is dry run
+    uint16_t clogMA;  // current at or above is clogged line
+    uint16_t stallMA;  // current at or above is locked rotor
+    uint16_t noneMA;  // current below means pump isn't running at all
+    uint16_t startupMs;  // inrush current after pump start is ignored
+    uint16_t faultMs;  // dry run and clog must last for given time
+    uint16_t stallMs;  // stall must last for given time
+} currentLimits_t;
+
+typedef struct {
+    const currentLimits_t* limits;
+    uint32_t runningMs;  // since pump start
+    uint32_t filtered;  // exponential moving average, mA * 16
+    uint16_t faultMs[CURRENT_FAULTS];  // time each condition has lasted
+} currentDetector_t;
+
+void currentReset(currentDetector_t* d, const currentLimits_t* limits);
+currentfault_t currentDetect(currentDetector_t* d, uint16_t mA, uint16_t elapsedMs);
+uint16_t currentFiltered(const currentDetector_t* d);
+const char* currentFaultString(currentfault_t fault);
+uint16_t currentFromADC(int32_t reading, uint16_t zero, uint16_t uAPerStep);
+
+#endif
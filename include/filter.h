@@ -0,0 +1,52 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <Arduino.h>
+
+#define FILTER_MAX_SIZE 9
+#define FILTER_EMA_FRACT 8  // fractional bits of smoothed value
+
+typedef enum {
+    FILTER_NONE,
+    FILTER_MEAN,  // moving average
+    FILTER_MEDIAN,
+    FILTER_TRIMMED,  // mean without lowest and highest quarter
+    FILTER_EMA,  // exponential smoothing
+    FILTER_HAMPEL  // replaces outliers by median
+} filtertype_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t size;  // window size or smoothing factor
+    uint8_t count;  // readings in window
+    uint8_t head;  // next window slot
+    int16_t window[FILTER_MAX_SIZE];  // readings in arrival order
+    int16_t sorted[FILTER_MAX_SIZE];  // same readings in ascending order
+    int32_t sum;  // sum of window or smoothed value for FILTER_EMA
+} filter_t;
+
+void filterInit(filter_t* f, filtertype_t type, uint8_t size);
+int16_t filterUpdate(filter_t* f, int16_t reading);
+const char* filterName(filtertype_t type);
+
+#endif
@@ -0,0 +1,55 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+
+
+#ifndef _HAL_H
+#define _HAL_H
+
+#include <Arduino.h>
+
+// clock and I/O access used by scheduler, relays and sensors;
+// defaults to ESP32 hardware, may be replaced by stand-ins e.g.
+// a virtual clock to fast-forward the irrigation schedule
+typedef struct {
+    uint64_t (*uptimeMillis)();  // monotonic, since boot
+    time_t (*utcTime)();  // seconds since epoch
+    void (*pinMode)(uint8_t pin, uint8_t mode);
+    void (*pinWrite)(uint8_t pin, uint8_t level);
+    void (*pinsWrite)(uint64_t set, uint64_t clear);  // bit n for GPIO n
+    uint16_t (*adcRead)(uint8_t pin);
+    void (*delayMs)(uint32_t ms);
+} hal_t;
+
+extern hal_t hal;
+
+void setHal(const hal_t* stub);
+void resetHal();
+
+#ifndef ARDUINO_ARCH_ESP32
+// host build (env:native), defaults run on a virtual clock
+// which only advances by halAdvance() or hal.delayMs()
+void halAdvance(uint32_t ms);
+void halSetTime(time_t utc);
+uint64_t halOutputs();
+void halSetAdc(uint8_t pin, uint16_t value);
+#endif
+
+#endif
@@ -237,22 +237,12 @@ function setValve(pin) {
     if (this.readyState == 4 && this.status == 200) {
       json = JSON.parse(xhttp.responseText);
 
-      if (Number(json.valve1) >= 0) {
-        setValveSwitch(1, Number(json.valve1));
-        document.getElementById("switch_valve1").style.display = "table-row";
-      }
-      if (Number(json.valve2) >= 0) {
-        setValveSwitch(2, Number(json.valve2));
-        document.getElementById("switch_valve2").style.display = "table-row";
-      }
-      if (Number(json.valve3) >= 0) {
-        setValveSwitch(3, Number(json.valve3));
-        document.getElementById("switch_valve3").style.display = "table-row";
+      for (var i = 1; document.getElementById("valve"+i); i++) {
+        if (Number(json["valve"+i]) >= 0) {
+          setValveSwitch(i, Number(json["valve"+i]));
+          document.getElementById("switch_valve"+i).style.display = "table-row";
+        }
       }
-      if (Number(json.valve4) >= 0) {
-        setValveSwitch(4, Number(json.valve4));
-        document.getElementById("switch_valve4").style.display = "table-row";
-      } 
     }
   }
 
@@ -295,10 +285,7 @@ function setValve(pin) {
 <div id="valves" style="margin-top:10px;">
 <fieldset><legend><b>&nbsp;Manuelle Ventilsteuerung&nbsp;</b></legend>
 <table style="min-width:325px">
-  <tr id="switch_valve1" style="display:none"><th>__RELAY1_LABEL__</th><td><label class="switch"><input id="valve1" type="checkbox" onclick="setValve(1);"><span id="valve1_slider" class="slider"></span></label></td></tr>
-  <tr id="switch_valve2" style="display:none"><th>__RELAY2_LABEL__</th><td><label class="switch"><input id="valve2" type="checkbox" onclick="setValve(2);"><span id="valve2_slider" class="slider"></span></label></td></tr>
-  <tr id="switch_valve3" style="display:none"><th>__RELAY3_LABEL__</th><td><label class="switch"><input id="valve3" type="checkbox" onclick="setValve(3);"><span id="valve3_slider" class="slider"></span></label></td></tr>
-  <tr id="switch_valve4" style="display:none"><th>__RELAY4_LABEL__</th><td><label class="switch"><input id="valve4" type="checkbox" onclick="setValve(4);"><span id="valve4_slider" class="slider"></span></label></td></tr>
+__VALVE_SWITCHES__
 </table>
 </fieldset>
 </div>
@@ -475,11 +462,11 @@ function checkInput() {
   var xhttp = new XMLHttpRequest();
 
   if (document.getElementById("checkbox_auto_irrigation").checked == true) {
-    if (!document.getElementById("input_irrigation_time").value.match(/^\d{2}:\d{2}$/)) {
+    if (!document.getElementById("input_irrigation_time").value.match(/^\d{2}:\d{2}(,\d{2}:\d{2}){0,3}$/)) {
       document.getElementById("timeError").style.display = "block";
       err++;
     }
-    for (var i = 1; i <= 4; i++) {
+    for (var i = 1; document.getElementById("input_irrigation_relay"+i); i++) {
       if (document.getElementById("input_irrigation_relay"+i).value > 
             document.getElementById("input_pump_autostop").value) {
         document.getElementById("irrTimeError").style.display = "block";
@@ -514,7 +501,7 @@ function digitsOnly(input) {
 }
 
 function timeOnly(input) {
-  var regex = /[^0-9:]/g;
+  var regex = /[^0-9:,]/g;
   input.value = input.value.replace(regex, "");
 }
 
@@ -542,9 +529,10 @@ function toggleWaterLevel() {
 <h2 id="heading">Einstellungen</h2>
 <div id="message" style="display:none;margin-top:10px;color:red;font-weight:bold;text-align:center;max-width:335px">
 <span id="configSaved" style="display:none;color:green">Einstellungen gespeichert</span>
-<span id="timeError" style="display:none">Uhrzeitformat prüfen (HH:MM)</span>
+<span id="timeError" style="display:none">Format der Startzeiten prüfen (HH:MM,HH:MM)</span>
 <span id="irrTimeError" style="display:none">Dauer Bewässerungszeiten prüfen!</span>
 </div>
+<div id="conflicts" style="margin-top:10px;color:red;font-size:small;text-align:center;max-width:335px">__PROGRAM_CONFLICTS__</div>
 </div>
 
 <div style="max-width:335px;margin-top:10px;">
@@ -552,18 +540,19 @@ function toggleWaterLevel() {
   <fieldset><legend><b>&nbsp;Automatische Bewässerung&nbsp;</b></legend>
   <p><input id="checkbox_auto_irrigation" name="auto_irrigation" type="checkbox" __AUTO_IRRIGATION__ onclick="toggleAutoIrrigation();"><b>Aktivieren</b></p>
   <span style="display:none" id="auto_irrigation">
-  <p><b>Uhrzeit (HH:MM)</b><br />
-  <input id="input_irrigation_time" name="irrigation_time" type="text" value="__IRRIGATION_TIME__" maxlength="5" onkeyup="timeOnly(this);"></p>
+  <p><b>Startzeiten (HH:MM,HH:MM,...)</b><br />
+  <input id="input_irrigation_time" name="irrigation_time" type="text" value="__IRRIGATION_TIME__" maxlength="23" onkeyup="timeOnly(this);"></p>
+  <p><b>Wochentage</b><br />
+  <input name="weekday1" type="checkbox" __WEEKDAY1__>Mo
+  <input name="weekday2" type="checkbox" __WEEKDAY2__>Di
+  <input name="weekday3" type="checkbox" __WEEKDAY3__>Mi
+  <input name="weekday4" type="checkbox" __WEEKDAY4__>Do
+  <input name="weekday5" type="checkbox" __WEEKDAY5__>Fr
+  <input name="weekday6" type="checkbox" __WEEKDAY6__>Sa
+  <input name="weekday0" type="checkbox" __WEEKDAY0__>So</p>
   <p><b>Min. Bewässerungspause (Std.)</b><br />
   <input id="input_irrigation_pause" name="irrigation_pause" type="text" value="__IRRIGATION_PAUSE__" maxlength="2" onkeyup="digitsOnly(this);"></p>
-  <p><b>__RELAY1_LABEL__ (Sek.)</b><br />
-  <input id="input_irrigation_relay1" name="irrigation_relay1_secs" type="text" value="__IRRIGATION_RELAY1_SECS__" maxlength="3" onkeyup="digitsOnly(this);"></p>
-  <p><b>__RELAY2_LABEL__ (Sek.)</b><br />
-  <input id="input_irrigation_relay2" name="irrigation_relay2_secs" type="text" value="__IRRIGATION_RELAY2_SECS__" maxlength="3" onkeyup="digitsOnly(this);"></p>
-  <p><b>__RELAY3_LABEL__ (Sek.)</b><br />
-  <input id="input_irrigation_relay3" name="irrigation_relay3_secs" type="text" value="__IRRIGATION_RELAY3_SECS__" maxlength="3" onkeyup="digitsOnly(this);"></p>
-  <p><b>__RELAY4_LABEL__ (Sek.)</b><br />
-  <input id="input_irrigation_relay4" name="irrigation_relay4_secs" type="text" value="__IRRIGATION_RELAY4_SECS__" maxlength="3" onkeyup="digitsOnly(this);"></p>
+__IRRIGATION_RELAY_SECS__
   </span>
   </fieldset>
   <br />
@@ -573,6 +562,8 @@ function toggleWaterLevel() {
   <input id="input_pump_autostop" name="pump_autostop" type="text" value="__PUMP_AUTOSTOP__" maxlength="3" onkeyup="digitsOnly(this);"></p>
   <p><b>Bewässerungssperre (Min.)</b><br />
   <input id="input_pump_blocktime" name="pump_blocktime" type="text" value="__PUMP_BLOCKTIME__" maxlength="4" onkeyup="digitsOnly(this);"></p>
+  <p><b>Pumpenleistung (l/Min., 0 = nur ein Ventil)</b><br />
+  <input id="input_pump_capacity" name="pump_capacity" type="text" value="__PUMP_CAPACITY__" maxlength="4" onkeyup="digitsOnly(this);"></p>
   <p><b>Höhe des Wasserbehälters (cm)</b><br />
   <input id="input_reservoir_height" name="reservoir_height" type="text" value="__RESERVOIR_HEIGHT__" maxlength="3" onkeyup="digitsOnly(this);"></p>
   <span id="input_min_water_level">
@@ -739,8 +730,8 @@ function checkInput() {
   var height = 0;
   var xhttp = new XMLHttpRequest();
 
-  for (var i = 1; i <= 3 && err == 0; i++) {
-    for (var j = i+1; j <= 4 && err == 0; j++) {
+  for (var i = 1; document.getElementById("relay"+i) && err == 0; i++) {
+    for (var j = i+1; document.getElementById("relay"+j) && err == 0; j++) {
       select1 = document.getElementById("relay"+i+"_pin_selector");
       select2 = document.getElementById("relay"+j+"_pin_selector");
       if (select1.options[select1.selectedIndex].value != -1 && 
@@ -805,10 +796,10 @@ function pinSelector(pins, id, parent, value) {
 }
 
 function initPage() {
-    pinSelector([ __RELAY_PINS__ ], "relay1_pin", document.getElementById("relay1"), __RELAY1_PIN__);
-    pinSelector([ __RELAY_PINS__ ], "relay2_pin", document.getElementById("relay2"), __RELAY2_PIN__);
-    pinSelector([ __RELAY_PINS__ ], "relay3_pin", document.getElementById("relay3"), __RELAY3_PIN__);
-    pinSelector([ __RELAY_PINS__ ], "relay4_pin", document.getElementById("relay4"), __RELAY4_PIN__);
+    for (var i = 1; document.getElementById("relay"+i); i++) {
+      var relay = document.getElementById("relay"+i);
+      pinSelector([ __RELAY_PINS__ ], "relay"+i+"_pin", relay, relay.dataset.pin);
+    }
     pinSelector([ __MOISTURE_PINS__ ], "moist1_pin", document.getElementById("moist1"), __MOIST1_PIN__);
     pinSelector([ __MOISTURE_PINS__ ], "moist2_pin", document.getElementById("moist2"), __MOIST2_PIN__);
     pinSelector([ __MOISTURE_PINS__ ], "moist3_pin", document.getElementById("moist3"), __MOIST3_PIN__);
@@ -830,10 +821,7 @@ function initPage() {
 <div style="max-width:335px;margin-top:10px;">
 <form method="POST" action="/pins" onsubmit="return checkInput();">
   <fieldset><legend><b>&nbsp;Ventilnamen und Pins&nbsp;</b></legend>
-  <p id="relay1"><input id="input_relay1" class="pin_label" type="text" name="relay1_name" size="16" maxlength="24" value="__RELAY1_LABEL__"></p>
-  <p id="relay2"><input id="input_relay2" class="pin_label" type="text" name="relay2_name" size="16" maxlength="24" value="__RELAY2_LABEL__"></p>
-  <p id="relay3"><input id="input_relay3" class="pin_label" type="text" name="relay3_name" size="16" maxlength="24" value="__RELAY3_LABEL__"></p>
-  <p id="relay4"><input id="input_relay4" class="pin_label" type="text" name="relay4_name" size="16" maxlength="24" value="__RELAY4_LABEL__"></p>
+__RELAY_NAMES__
   </fieldset>
   <br />
 
@@ -856,3 +844,15 @@ function initPage() {
 <p><button onclick="location.href='/';">Startseite</button></p>
 </div>
 )=====";
+
+
+// rows repeated for each valve by web.cpp, see relayRows()
+const char VALVE_SWITCH_html[] PROGMEM = R"=====(
+  <tr id="switch_valve__N__" style="display:none"><th>__LABEL__</th><td><label class="switch"><input id="valve__N__" type="checkbox" onclick="setValve(__N__);"><span id="valve__N___slider" class="slider"></span></label></td></tr>)=====";
+
+const char IRRIGATION_SECS_html[] PROGMEM = R"=====(
+  <p><b>__LABEL__ (Sek.)</b><br />
+  <input id="input_irrigation_relay__N__" name="irrigation_relay__N___secs" type="text" value="__SECS__" maxlength="3" onkeyup="digitsOnly(this);"></p>)=====";
+
+const char RELAY_NAME_html[] PROGMEM = R"=====(
+  <p id="relay__N__" data-pin="__PIN__"><input id="input_relay__N__" class="pin_label" type="text" name="relay__N___name" size="16" maxlength="24" value="__LABEL__"></p>)=====";
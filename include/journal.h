@@ -0,0 +1,51 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <Arduino.h>
+#include "scheduler.h"
+#include "utils.h"
+
+#define JOURNAL_MAGIC 0x4A4F4231  // "JOB1"
+#define JOURNAL_MAX_JOBS 32
+
+// compact copy of pending valve jobs and open valves,
+// each record holds the deadline relative to the time the
+// journal was written in 100ms (bits 31-6), the target
+// state (bit 5) and the relay number (bits 4-0)
+typedef struct {
+    uint32_t magic;
+    uint32_t written;  // UTC, 0 if system time wasn't set
+    uint32_t openValves;  // bit n set if relay n was open
+    uint16_t count;
+    uint16_t aliveSecs;  // system last seen alive, secs after written
+    uint32_t records[JOURNAL_MAX_JOBS];
+    uint32_t checksum;
+} jobJournal_t;
+
+void journalUpdate();
+void journalSync();
+void journalRecover(rstcodes mode);
+
+#endif
@@ -24,8 +24,23 @@
 #include <Arduino.h>
 #include <Preferences.h>  // use NVS instead of EEPROM (depreciated on ESP32)
 
+// number of valves (max. 31), e.g. -DNUM_RELAY=16; only the first 
+// four valves have defaults in config.h, further valves are disabled 
+// until a pin has been assigned on the web ui
+#ifndef NUM_RELAY
 #define NUM_RELAY 4
+#endif
 #define NUM_MOISTURE_SENSORS 4
+#define MAX_PROGRAMS 4
+#define MAX_PROGRAM_STARTS 4
+
+// recurring irrigation program, start times are local time
+typedef struct {
+    bool enabled;
+    uint8_t weekdays;  // bit 0 = sunday ... bit 6 = saturday
+    int16_t starts[MAX_PROGRAM_STARTS];  // minutes after midnight, -1 if unused
+    uint16_t secs[NUM_RELAY];  // runtime per valve
+} irrigationProgram_t;
 
 typedef struct  {
     uint16_t wifiAPT;
@@ -43,6 +58,16 @@ typedef struct  {
     bool clearNVSFwUpdate; // no switch in web ui
 } generalPrefs_t;
 
+// NVS key of switchesPrefs, settings stored for another 
+// number of valves don't fit and are thus kept apart
+#define PREFS_STR(x) #x
+#define PREFS_KEY(name, n) name PREFS_STR(n)
+#if NUM_RELAY == 4
+#define SWITCHES_PREFS_KEY "switchesPrefs"
+#else
+#define SWITCHES_PREFS_KEY PREFS_KEY("switchesPrefs", NUM_RELAY)
+#endif
+
 typedef struct {
     int8_t pinRelay[NUM_RELAY];
     char labelRelay[NUM_RELAY][25];
@@ -52,8 +77,7 @@ typedef struct {
     uint16_t pumpAutoStopSecs;
     uint32_t relaysBlockMins;
     bool enableAutoIrrigation;
-    char autoIrrigationTime[8];
-    uint16_t autoIrrigationSecs[4];
+    irrigationProgram_t irrigationPrograms[MAX_PROGRAMS];
     uint8_t autoIrrigationPauseHours;
     bool enableLogging;
     uint8_t minWaterLevel;
@@ -63,6 +87,9 @@ typedef struct {
     uint16_t moistureMax;
     bool moistureRaw;
     bool moistureMovingAvg;
+    uint16_t pumpCapacity;  // l/min, 0 for one valve at a time
+    uint16_t flowRelay[NUM_RELAY];  // l/min, 0 runs valve on its own
+    uint16_t rateRelay[NUM_RELAY];  // measured l/min for water usage, 0 if unknown
 } switchesPrefs_t;
 
 extern Preferences nvs;
@@ -0,0 +1,99 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+
+
+#ifndef _PROGRAMS_H
+#define _PROGRAMS_H
+
+#include <Arduino.h>
+#include "prefs.h"
+#include "scheduler.h"
+
+#define PREVIEW_DEFAULT_EVENTS 50
+#define PREVIEW_MAX_EVENTS 1000
+#define PREVIEW_MAX_DAYS 366
+
+#define MAX_CONFLICTS 16
+
+// conflicts found by checkPrograms()
+#define CONFLICT_OVERLAP 0  // program starts while another one is running, deferred
+#define CONFLICT_DROPPED 1  // start time missed while deferred
+#define CONFLICT_PAUSED 2  // valve skipped, used within autoIrrigationPauseHours
+#define CONFLICT_BLOCKED 3  // valve still blocked (relaysBlockMins)
+#define CONFLICT_AUTOSTOP 4  // runtime exceeds pumpAutoStopSecs
+
+typedef struct {
+    uint8_t kind;
+    uint8_t prog;  // program (1..MAX_PROGRAMS)
+    int16_t start;  // start time, minutes after midnight
+    uint8_t relay;  // affected valve, 0 for whole program
+    uint8_t other;  // program running at start time (overlap)
+    uint8_t weekdays;  // affected weekdays (bit 0 = sunday)
+} programConflict_t;
+
+// valve run of a program, secs relative to program start
+typedef struct {
+    uint32_t open;
+    uint32_t close;
+    uint8_t relay;
+} valveRun_t;
+
+// upcoming valve event as returned by previewNext()
+typedef struct {
+    time_t time;  // UTC
+    uint8_t prog;  // program (1..MAX_PROGRAMS), 0 for already queued jobs
+    uint8_t relay;
+    bool state;
+    bool blocked;  // valve would still be blocked (relaysBlockMins)
+} previewEvent_t;
+
+// state of schedule preview, events are generated one at a time
+// by simulating programScheduler() so a preview of weeks ahead
+// needs no more memory than this struct
+typedef struct {
+    time_t now;  // simulated time (UTC)
+    time_t nextStart[MAX_PROGRAMS];
+    time_t lastUse[NUM_RELAY + 1];  // simulated pintime[] (UTC)
+    time_t seqStart;  // valve runs of running program are relative to this
+    time_t busyUntil;  // programs are deferred while jobs are pending
+    time_t until;  // no programs started after this time
+    valvejob_t job;  // last queued job returned
+    valveRun_t runs[NUM_RELAY];  // valve runs of running program
+    uint32_t opened;  // bit k set if runs[k] has been opened
+    uint32_t closed;  // bit k set if runs[k] has been closed
+    uint32_t blocked;  // bit n set if open of valve n is blocked
+    uint8_t numRuns;
+    uint8_t prog;  // running program, MAX_PROGRAMS if none
+    bool queued;  // still returning jobs already in queue
+} schedulePreview_t;
+
+void updatePrograms();
+void programScheduler();
+time_t nextProgramStart(uint8_t prog);
+char* programStartsString(uint8_t prog);
+bool parseProgramStarts(irrigationProgram_t* prog, const char* str);
+uint8_t checkPrograms(programConflict_t* conflicts, uint8_t max);
+char* programConflictString(const programConflict_t* conflict);
+void previewBegin(schedulePreview_t* p);
+bool previewNext(schedulePreview_t* p, previewEvent_t* ev);
+uint16_t previewEventString(const previewEvent_t* ev, char* buf, size_t s);
+
+#endif
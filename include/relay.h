@@ -24,16 +24,72 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
+#include "prefs.h"
 
-extern uint16_t pinmap[5][3];
-extern char pinnames[5][7];
-extern uint32_t pintime[];
+// max. size of JSON returned by relayStatus()
+#define RELAY_STATUS_SIZE (16 + (NUM_RELAY + 1) * 12)
+
+// pending relay transitions not yet logged, power of 2 with
+// room for two transitions (e.g. close and block) per relay
+#define RELAY_LOG_SIZE (2 * (NUM_RELAY + 1) <= 16 ? 16 : (2 * (NUM_RELAY + 1) <= 32 ? 32 : 64))
+
+// relay 0 is the pump, relays 1..NUM_RELAY are valves
+typedef enum {
+    RELAY_OFF,
+    RELAY_ON,
+    RELAY_BLOCKED,  // valve recently used (relaysBlockMins)
+    RELAY_LOCKED,  // locked out e.g. due to low water level
+    RELAY_STATES
+} relaystate_t;
+
+typedef enum {
+    RELAY_OPEN,
+    RELAY_CLOSE,
+    RELAY_BLOCK,
+    RELAY_UNBLOCK,
+    RELAY_LOCKOUT,
+    RELAY_RELEASE,
+    RELAY_EVENTS
+} relayevent_t;
+
+typedef enum {
+    RELAY_LOG_OFF,
+    RELAY_LOG_ON,
+    RELAY_LOG_BLOCKED  // valve couldn't be opened
+} relaylogtype_t;
+
+// relay transition queued for logging
+typedef struct {
+    uint32_t millis;
+    int16_t waterLevel;
+    uint8_t relay;
+    uint8_t type;  // relaylogtype_t
+} relaylog_t;
+
+extern relaystate_t relaystate[NUM_RELAY + 1];
+extern char pinnames[NUM_RELAY + 1][8];
+extern uint32_t pintime[NUM_RELAY + 1];
 
 void initRelays();
+uint16_t valveFlow(uint8_t num);
+bool valveFits(uint8_t num);
+bool relayEvent(uint8_t num, relayevent_t event);
+void relayOutputs();
 void setRelay(uint8_t num, bool on);
+void requestRelay(uint8_t num, bool on);
+void relayCommands();
+void relayCommandStats(uint32_t* coalesced, uint32_t* deferred);
 void unblockRelays();
-uint16_t relayStatus(char* buf, size_t s);
+uint32_t relaysOpen();
+int8_t relayStatusCode(uint8_t num);
+uint32_t relayVersion();
+void relayStatusChanged();
+const char* relayStatus(uint16_t* len);
 void pumpAutoStop();
-
+void pumpMonitor();
+bool checkInterlocks();
+void logRelayEvents();
+bool relayPublishDue();
+void relayPublishRetry();
 
 #endif
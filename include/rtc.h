@@ -38,6 +38,10 @@ bool startNTPSync();
 void stopNTPSync();
 char* getRuntime(uint32_t runtimeSecs);
 time_t getLocalTime();
+time_t getUTCTime();
+time_t localToUTC(time_t local);
+time_t utcToLocal(time_t utc);
+uint64_t getUptimeMillis();
 char* getSystemTime();
 char* getTimeString(bool showsecs);
 char* getDateString();
@@ -24,25 +24,72 @@
 #define _SCHEDULER_H
 
 #include <Arduino.h>
-#include <sys/time.h>
+#include "config.h"
 
+#ifndef MAX_JOBS
 #define MAX_JOBS 16
+#endif
+#define LATENESS_BUCKETS 16  // log2 buckets, last one is open ended
+
+#ifdef SCHEDULER_TIMING_WHEEL
+#define WHEEL_TICK_MS 10
+#define WHEEL_LEVELS 5  // 64 slots per level, covers 2^30 ticks (~124 days)
+#define WHEEL_SLOTS 64
+#endif
+
+#define JOB_INVALID 0
+#define JOB_FREE 0xFFFF
 
 typedef struct valvejob_t valvejob_t;
 typedef void (*jobfn_t)(uint8_t, bool);  // setRelay()
+typedef uint32_t jobhandle_t;  // generation (high word), pool slot + 1 (low word)
 
-extern valvejob_t valvejobs[MAX_JOBS];
+// priority classes, a job preempts all jobs of lower classes
+typedef enum {
+    JOB_SAFETY,  // e.g. emergency stop, never preempted
+    JOB_MANUAL,  // commands from web ui or MQTT
+    JOB_PROGRAM,  // irrigation programs
+    JOB_BACKGROUND,
+    JOB_PRIORITIES
+} jobprio_t;
+
+// dispatch lateness (actual minus planned time) of executed jobs
+typedef struct {
+    uint32_t jobs;
+    uint32_t minMillis;
+    uint32_t maxMillis;
+    uint64_t sumMillis;
+    uint32_t histogram[LATENESS_BUCKETS];
+} schedulerStats_t;
+
+extern schedulerStats_t schedulerStats;
 
 struct valvejob_t {
-    struct valvejob_t* next;
-    time_t time;
+    uint64_t time;  // deadline on monotonic clock (ms), see getUptimeMillis()
+    uint32_t seq;   // keeps jobs with same deadline in order of scheduling
+    uint16_t gen;   // incremented on every release of the pool slot
+    uint16_t pos;   // position in heap or wheel slot, JOB_FREE if unused
+    uint32_t epoch; // job is stale if its class was preempted since scheduling
+    uint8_t prio;
+#ifdef SCHEDULER_TIMING_WHEEL
+    uint16_t prev;  // neighbours in wheel slot list
+    uint16_t next;
+#endif
     jobfn_t func;
     uint8_t relay;
     bool state;
 };
 
-void schedule_job (valvejob_t* job, time_t time, jobfn_t func, uint8_t relay, bool state);
+jobhandle_t schedule_job(uint64_t time, jobfn_t func, uint8_t relay, bool state, jobprio_t prio);
+bool cancel_job(jobhandle_t handle);
+bool reschedule_job(jobhandle_t handle, uint64_t time);
+uint16_t preempt_jobs(jobprio_t prio, uint32_t keepRelays);
 bool jobs_scheduled();
+uint16_t jobs_pending();
+bool jobs_due(uint64_t time, bool state);
+uint16_t jobs_list(valvejob_t* jobs, uint16_t max);
+bool jobs_next(valvejob_t* job);
 void scheduler();
+uint32_t scheduler_lateness(uint8_t percentile);
 
 #endif
@@ -23,23 +23,24 @@
 
 #include <Arduino.h>
 #include <HTU21D.h>
-#include <HCSR04.h>
 #include <driver/adc.h>
 
-#define MOISTURE_MA_WINDOW_SIZE 5
-
 typedef struct  {
     float temperature;
     uint8_t humidity;
     int16_t waterLevel;
     int16_t moisture[4];
+    int16_t moistureReading[4];  // filtered ADC reading
+    uint16_t pumpCurrent;  // mA
 } sensorReadings_t;
 
-extern sensorReadings_t sensors;
-
 void initSensors();
-void readTemp(bool verbose, bool log);
-void readWaterLevel(bool verbose, bool log);
-void readMoisture(bool verbose, bool log, bool reset);
+void sensorsChanged();
+void sensorsActivity(bool active);
+void sensorSamples(uint32_t* taken, uint32_t* saved);
+sensorReadings_t sensorSnapshot();
+void reportTemp(bool verbose, bool log);
+void reportWaterLevel(bool verbose, bool log);
+void reportMoisture(bool verbose, bool log);
 
 #endif
@@ -0,0 +1,35 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _ULTRASONIC_H
+#define _ULTRASONIC_H
+
+#include <Arduino.h>
+
+#define US_TRIGGER_US 10  // trigger pulse width
+#define US_ECHO_MAX_US 38000  // echo width if no object in range
+#define US_TIMEOUT_US 50000  // give up on ping without echo
+#define US_US_PER_CM 58  // round trip at 343 m/s
+
+void usBegin(int8_t triggerPin, int8_t echoPin);
+bool usPing();
+bool usRange(int16_t* distance);
+
+#endif
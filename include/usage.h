@@ -0,0 +1,57 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _USAGE_H
+#define _USAGE_H
+
+#include <Arduino.h>
+#include "prefs.h"
+
+#define USAGE_MAGIC 0x55534731  // "USG1"
+#define USAGE_DAYS 7
+
+// max. size of JSON returned by usageStatus()
+#define USAGE_STATUS_SIZE (8 + 4 * (16 + (NUM_RELAY + 1) * 32))
+
+// open duration and estimated water volume of a valve
+typedef struct {
+    uint32_t secs;
+    uint32_t ml;
+} valveUsage_t;
+
+// running totals per valve, index 0 sums up all valves; daily
+// buckets are a ring indexed by local day number % USAGE_DAYS,
+// weeks start on monday
+typedef struct {
+    uint32_t magic;
+    uint32_t day;  // local day number of today's bucket, 0 if time unknown
+    uint32_t week;  // local week number of current week
+    valveUsage_t total[NUM_RELAY + 1];  // since power up
+    valveUsage_t days[USAGE_DAYS][NUM_RELAY + 1];
+    valveUsage_t thisWeek[NUM_RELAY + 1];
+    valveUsage_t lastWeek[NUM_RELAY + 1];
+    uint32_t checksum;
+} waterUsage_t;
+
+void initUsage();
+void usageAdd(uint8_t relay, uint32_t millis);
+uint16_t usageStatus(char* buf, size_t s);
+
+#endif
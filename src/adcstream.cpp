@@ -0,0 +1,170 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "adcstream.h"
+#include <driver/adc.h>
+
+// continuous sampling of ADC1 channels by the digital controller (DMA);
+// raw samples are averaged in blocks of ADC_STREAM_BLOCK and kept in a 
+// ring buffer per channel, so reading a filtered value never blocks
+typedef struct {
+    uint16_t ring[ADC_STREAM_SAMPLES];
+    uint32_t blockSum;
+    uint16_t blockCount;
+    uint8_t head;  // next ring entry to write
+    uint8_t count;  // valid ring entries
+} adcChannel_t;
+
+static adcChannel_t channels[ADC_STREAM_CHANNELS];
+static int8_t channelPins[ADC_STREAM_CHANNELS];  // gpio, -1 if not sampled
+static bool streaming = false;
+
+
+// ADC1 channel of gpio or -1
+static int8_t adcChannel(int8_t pin) {
+    int8_t ch;
+
+    for (ch = 0; ch < ADC_STREAM_CHANNELS; ch++) {
+        if (channelPins[ch] == pin)
+            return ch;
+    }
+    return -1;
+}
+
+
+// start continuous sampling of given pins, pins 
+// not connected to ADC1 are ignored
+bool adcStreamBegin(const int8_t* pins, uint8_t n) {
+    adc_digi_pattern_config_t pattern[ADC_STREAM_CHANNELS];
+    adc_digi_init_config_t init;
+    adc_digi_configuration_t config;
+    uint8_t num = 0;
+    int8_t ch;
+
+    adcStreamEnd();
+    memset(channels, 0, sizeof(channels));
+    memset(channelPins, -1, sizeof(channelPins));
+    for (uint8_t i = 0; i < n; i++) {
+        ch = (pins[i] >= 0) ? digitalPinToAnalogChannel(pins[i]) : -1;
+        if (ch < 0 || ch >= ADC_STREAM_CHANNELS || channelPins[ch] >= 0)
+            continue;
+        channelPins[ch] = pins[i];
+        pattern[num].atten = ADC_ATTEN_DB_11;
+        pattern[num].channel = ch;
+        pattern[num].unit = 0;  // ADC1
+        pattern[num].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+        num++;
+    }
+    if (!num)
+        return false;
+
+    memset(&init, 0, sizeof(init));
+    init.max_store_buf_size = ADC_STREAM_READ_BYTES * 4;
+    init.conv_num_each_intr = ADC_STREAM_READ_BYTES;
+    for (uint8_t i = 0; i < num; i++)
+        init.adc1_chan_mask |= (1 << pattern[i].channel);
+    if (adc_digi_initialize(&init) != ESP_OK)
+        return false;
+
+    memset(&config, 0, sizeof(config));
+    config.conv_limit_en = 1;
+    config.conv_limit_num = 250;
+    config.pattern_num = num;
+    config.adc_pattern = pattern;
+    config.sample_freq_hz = ADC_STREAM_FREQ_HZ;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+    if (adc_digi_controller_configure(&config) != ESP_OK || adc_digi_start() != ESP_OK) {
+        adc_digi_deinitialize();
+        return false;
+    }
+    streaming = true;
+    return true;
+}
+
+
+void adcStreamEnd() {
+    if (!streaming)
+        return;
+    adc_digi_stop();
+    adc_digi_deinitialize();
+    streaming = false;
+}
+
+
+// move converted samples from DMA buffer into ring buffers, never
+// waits for new samples; called by sensor task pinned to core 0
+// (SENSOR_TASK_CORE) and once from initSensors() before it starts;
+// ring buffers aren't locked, their readers and the seqlock writer
+// of sensor readings run in the same task
+void adcStreamPoll() {
+    static uint8_t buf[ADC_STREAM_READ_BYTES];
+    adc_digi_output_data_t* sample;
+    adcChannel_t* c;
+    uint32_t len;
+
+    if (!streaming)
+        return;
+
+    // bounded number of reads so a full DMA buffer can't stall the loop
+    for (uint8_t r = 0; r < 4; r++) {
+        if (adc_digi_read_bytes(buf, sizeof(buf), &len, 0) != ESP_OK || !len)
+            return;
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            sample = (adc_digi_output_data_t*)&buf[i];
+            if (sample->type1.channel >= ADC_STREAM_CHANNELS || channelPins[sample->type1.channel] < 0)
+                continue;
+            c = &channels[sample->type1.channel];
+            c->blockSum += sample->type1.data;
+            if (++c->blockCount < ADC_STREAM_BLOCK)
+                continue;
+            c->ring[c->head] = c->blockSum / ADC_STREAM_BLOCK;
+            c->head = (c->head + 1) % ADC_STREAM_SAMPLES;
+            if (c->count < ADC_STREAM_SAMPLES)
+                c->count++;
+            c->blockSum = 0;
+            c->blockCount = 0;
+        }
+    }
+}
+
+
+// check if pin is sampled continuously
+bool adcStreaming(int8_t pin) {
+    return streaming && pin >= 0 && adcChannel(pin) >= 0;
+}
+
+
+// average (12 bit) of given number of most recent blocks 
+// (0 for all) of pin, -1 if no samples are available yet
+int16_t adcStreamValue(int8_t pin, uint8_t blocks) {
+    int8_t ch = adcChannel(pin);
+    adcChannel_t* c;
+    uint32_t sum = 0;
+
+    if (!streaming || ch < 0 || !channels[ch].count)
+        return -1;
+    c = &channels[ch];
+    if (!blocks || blocks > c->count)
+        blocks = c->count;
+    for (uint8_t i = 1; i <= blocks; i++)
+        sum += c->ring[(c->head + ADC_STREAM_SAMPLES - i) % ADC_STREAM_SAMPLES];
+    return sum / blocks;
+}
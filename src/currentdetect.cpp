@@ -0,0 +1,89 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include "currentdetect.h"
+
+
+// restart detection, e.g. when pump is switched on
+void currentReset(currentDetector_t* d, const currentLimits_t* limits) {
+    memset(d, 0, sizeof(currentDetector_t));
+    d->limits = limits;
+}
+
+
+// filtered current in mA
+uint16_t currentFiltered(const currentDetector_t* d) {
+    return d->filtered / 16;
+}
+
+
+// add current sample taken given ms after previous one, the samples are
+// smoothed with an exponential moving average (alpha 1/4) and a fault is
+// returned once its condition has lasted long enough; O(1) per sample
+currentfault_t currentDetect(currentDetector_t* d, uint16_t mA, uint16_t elapsedMs) {
+    const currentLimits_t* l = d->limits;
+    currentfault_t condition = CURRENT_OK;
+    uint16_t avg;
+
+    if (d->runningMs == 0 && d->filtered == 0)
+        d->filtered = (uint32_t)mA * 16;  // first sample
+    else
+        d->filtered = d->filtered - d->filtered / 4 + (uint32_t)mA * 4;
+    d->runningMs += elapsedMs;
+    if (d->runningMs < l->startupMs)
+        return CURRENT_OK;
+
+    avg = currentFiltered(d);
+    if (avg >= l->stallMA || avg < l->noneMA)
+        condition = CURRENT_STALL;
+    else if (avg >= l->clogMA)
+        condition = CURRENT_CLOG;
+    else if (avg <= l->dryMA)
+        condition = CURRENT_DRY;
+
+    for (uint8_t i = 0; i < CURRENT_FAULTS; i++) {
+        if (i != condition)
+            d->faultMs[i] = 0;
+        else if (d->faultMs[i] < 0xFFFF - elapsedMs)
+            d->faultMs[i] += elapsedMs;
+    }
+
+    if (condition == CURRENT_STALL && d->faultMs[condition] >= l->stallMs)
+        return CURRENT_STALL;
+    if (condition != CURRENT_OK && condition != CURRENT_STALL && d->faultMs[condition] >= l->faultMs)
+        return condition;
+    return CURRENT_OK;
+}
+
+
+const char* currentFaultString(currentfault_t fault) {
+    const char* faults[] = { "ok", "dry run", "clogged", "stalled" };
+    return (fault < CURRENT_FAULTS) ? faults[fault] : "unknown";
+}
+
+
+// current (mA) of hall sensor from ADC reading, zero and
+// uAPerStep must be given for the resolution of the reading
+uint16_t currentFromADC(int32_t reading, uint16_t zero, uint16_t uAPerStep) {
+    int32_t mA = abs(reading - zero) * (int32_t)uAPerStep / 1000;
+    return (mA > 0xFFFF) ? 0xFFFF : mA;
+}
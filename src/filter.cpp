@@ -0,0 +1,166 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "filter.h"
+
+// fixed-point filters for sensor readings, all filters except 
+// FILTER_EMA keep a window of the last readings both in arrival 
+// and in sorted order, so mean is O(1), median O(1) and trimmed mean
+// O(size/4) per reading; keeping the sorted copy takes a binary search
+// and a short memmove; no floats involved
+
+
+// index of first value in sorted window not less than given value
+static uint8_t lowerBound(const filter_t* f, int16_t value) {
+    uint8_t lo = 0, hi = f->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (f->sorted[mid] < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+static void sortedRemove(filter_t* f, int16_t value) {
+    uint8_t i = lowerBound(f, value);
+
+    memmove(&f->sorted[i], &f->sorted[i+1], (f->count - i - 1) * sizeof(int16_t));
+    f->count--;
+}
+
+
+static void sortedInsert(filter_t* f, int16_t value) {
+    uint8_t i = lowerBound(f, value);
+
+    memmove(&f->sorted[i+1], &f->sorted[i], (f->count - i) * sizeof(int16_t));
+    f->sorted[i] = value;
+    f->count++;
+}
+
+
+static int16_t median(const filter_t* f) {
+    if (f->count & 1)
+        return f->sorted[f->count / 2];
+    return ((int32_t)f->sorted[f->count/2 - 1] + f->sorted[f->count/2]) / 2;
+}
+
+
+// mean without count/4 lowest and highest readings
+static int16_t trimmedMean(const filter_t* f) {
+    uint8_t trim = f->count / 4;
+    int32_t sum = f->sum;
+
+    for (uint8_t i = 0; i < trim; i++)
+        sum -= f->sorted[i] + f->sorted[f->count - 1 - i];
+    return sum / (f->count - 2 * trim);
+}
+
+
+// reading is replaced by median if it's off by more than three
+// scaled median absolute deviations (3 * 1.4826 ~ 71/16)
+static int16_t hampel(const filter_t* f, int16_t reading) {
+    int16_t med, dev[FILTER_MAX_SIZE], d;
+    int32_t mad, limit;
+    uint8_t i, j;
+
+    if (f->count < 3)
+        return reading;
+
+    med = median(f);
+    for (i = 0; i < f->count; i++) {  // insertion sort, at most 9 values
+        d = abs(f->sorted[i] - med);
+        for (j = i; j > 0 && dev[j-1] > d; j--)
+            dev[j] = dev[j-1];
+        dev[j] = d;
+    }
+    mad = (f->count & 1) ? dev[f->count/2] : ((int32_t)dev[f->count/2 - 1] + dev[f->count/2]) / 2;
+    limit = (max(mad, (int32_t)1) * 71) >> 4;
+    return (abs(reading - med) > limit) ? med : reading;
+}
+
+
+// filter window size is limited to FILTER_MAX_SIZE readings, 
+// for FILTER_EMA size sets smoothing factor to about 2/(size+1)
+void filterInit(filter_t* f, filtertype_t type, uint8_t size) {
+    memset(f, 0, sizeof(filter_t));
+    f->type = type;
+    f->size = constrain(size, 1, FILTER_MAX_SIZE);
+}
+
+
+// add reading to filter and return filtered value, readings are
+// filtered as soon as they arrive, no need to wait for a full window
+int16_t filterUpdate(filter_t* f, int16_t reading) {
+    uint8_t shift = 0;
+
+    if (f->type == FILTER_NONE)
+        return reading;
+
+    if (f->type == FILTER_EMA) {
+        while ((2 << shift) < f->size + 1)
+            shift++;
+        if (!f->count) {
+            f->sum = (int32_t)reading << FILTER_EMA_FRACT;
+            f->count = 1;
+        } else {
+            f->sum += (((int32_t)reading << FILTER_EMA_FRACT) - f->sum) >> shift;
+        }
+        return (f->sum + (1 << (FILTER_EMA_FRACT - 1))) >> FILTER_EMA_FRACT;
+    }
+
+    // drop oldest reading from full window
+    if (f->count == f->size) {
+        sortedRemove(f, f->window[f->head]);
+        f->sum -= f->window[f->head];
+    }
+    f->window[f->head] = reading;
+    f->head = (f->head + 1) % f->size;
+    sortedInsert(f, reading);
+    f->sum += reading;
+
+    switch (f->type) {
+        case FILTER_MEAN:
+            return f->sum / f->count;
+        case FILTER_MEDIAN:
+            return median(f);
+        case FILTER_TRIMMED:
+            return trimmedMean(f);
+        case FILTER_HAMPEL:
+            return hampel(f, reading);
+        default:
+            return reading;
+    }
+}
+
+
+const char* filterName(filtertype_t type) {
+    switch (type) {
+        case FILTER_MEAN: return "mean";
+        case FILTER_MEDIAN: return "median";
+        case FILTER_TRIMMED: return "trimmed";
+        case FILTER_EMA: return "ema";
+        case FILTER_HAMPEL: return "hampel";
+        default: return "none";
+    }
+}
@@ -0,0 +1,196 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "hal.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <esp_timer.h>
+#include <soc/gpio_reg.h>
+
+
+static uint64_t hwUptimeMillis() {
+    return esp_timer_get_time() / 1000;
+}
+
+
+static time_t hwUTCTime() {
+    time_t now;
+    time(&now);
+    return now;
+}
+
+
+static void hwPinMode(uint8_t pin, uint8_t mode) {
+    pinMode(pin, mode);
+}
+
+
+static void hwPinWrite(uint8_t pin, uint8_t level) {
+    digitalWrite(pin, level);
+}
+
+
+// drive several outputs with one write to the set and clear
+// registers of each GPIO bank, so they switch simultaneously
+static void hwPinsWrite(uint64_t set, uint64_t clear) {
+    if ((uint32_t)clear)
+        REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clear);
+    if ((uint32_t)set)
+        REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)set);
+    if (clear >> 32)
+        REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clear >> 32));
+    if (set >> 32)
+        REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(set >> 32));
+}
+
+
+static uint16_t hwAdcRead(uint8_t pin) {
+    return analogRead(pin);
+}
+
+
+static void hwDelayMs(uint32_t ms) {
+    delay(ms);
+}
+
+#else
+
+// host build: virtual clock, output and ADC images
+static uint64_t hostMillis = 0;
+static time_t hostEpoch = 0;  // UTC at hostMillis 0
+static uint64_t hostOutputs = 0;
+static uint16_t hostAdc[64];
+
+
+void halAdvance(uint32_t ms) {
+    hostMillis += ms;
+}
+
+
+void halSetTime(time_t utc) {
+    hostEpoch = utc - hostMillis / 1000;
+}
+
+
+uint64_t halOutputs() {
+    return hostOutputs;
+}
+
+
+void halSetAdc(uint8_t pin, uint16_t value) {
+    hostAdc[pin & 63] = value;
+}
+
+
+static uint64_t hwUptimeMillis() {
+    return hostMillis;
+}
+
+
+static time_t hwUTCTime() {
+    return hostEpoch + hostMillis / 1000;
+}
+
+
+static void hwPinMode(uint8_t pin, uint8_t mode) {
+}
+
+
+static void hwPinWrite(uint8_t pin, uint8_t level) {
+    if (level)
+        hostOutputs |= 1ULL << pin;
+    else
+        hostOutputs &= ~(1ULL << pin);
+}
+
+
+static void hwPinsWrite(uint64_t set, uint64_t clear) {
+    hostOutputs = (hostOutputs & ~clear) | set;
+}
+
+
+static uint16_t hwAdcRead(uint8_t pin) {
+    return hostAdc[pin & 63];
+}
+
+
+static void hwDelayMs(uint32_t ms) {
+    halAdvance(ms);
+}
+
+
+// Arduino core timing on top of the virtual clock,
+// millis() wraps after ~49 days just like on the ESP32
+unsigned long millis() {
+    return (uint32_t)hal.uptimeMillis();
+}
+
+
+void delay(uint32_t ms) {
+    hal.delayMs(ms);
+}
+
+#endif
+
+
+// used if a stand-in only replaces pinWrite,
+// so it still sees every single pin change
+static void pinsWriteEach(uint64_t set, uint64_t clear) {
+    for (uint8_t pin = 0; pin < 64; pin++) {
+        if (clear & (1ULL << pin))
+            hal.pinWrite(pin, 0);
+        else if (set & (1ULL << pin))
+            hal.pinWrite(pin, 1);
+    }
+}
+
+
+static const hal_t hwHal = {
+    hwUptimeMillis,
+    hwUTCTime,
+    hwPinMode,
+    hwPinWrite,
+    hwPinsWrite,
+    hwAdcRead,
+    hwDelayMs
+};
+
+hal_t hal = hwHal;
+
+
+// replace hardware access, unset functions keep using hardware
+void setHal(const hal_t* stub) {
+    hal.uptimeMillis = stub->uptimeMillis ? stub->uptimeMillis : hwHal.uptimeMillis;
+    hal.utcTime = stub->utcTime ? stub->utcTime : hwHal.utcTime;
+    hal.pinMode = stub->pinMode ? stub->pinMode : hwHal.pinMode;
+    hal.pinWrite = stub->pinWrite ? stub->pinWrite : hwHal.pinWrite;
+    if (stub->pinsWrite)
+        hal.pinsWrite = stub->pinsWrite;
+    else
+        hal.pinsWrite = stub->pinWrite ? pinsWriteEach : hwHal.pinsWrite;
+    hal.adcRead = stub->adcRead ? stub->adcRead : hwHal.adcRead;
+    hal.delayMs = stub->delayMs ? stub->delayMs : hwHal.delayMs;
+}
+
+
+// switch back to hardware access
+void resetHal() {
+    hal = hwHal;
+}
@@ -0,0 +1,234 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "config.h"
+#include "journal.h"
+#include "relay.h"
+#include "rtc.h"
+#include "prefs.h"
+#include "logging.h"
+
+// RTC slow memory survives watchdog resets, exceptions
+// and soft restarts but isn't initialized on power up
+static RTC_NOINIT_ATTR jobJournal_t rtcJournal;
+static bool journalChanged = false;
+
+
+// FNV-1a hash over journal excluding checksum
+static uint32_t journalChecksum(const jobJournal_t* journal) {
+    const uint8_t* data = (const uint8_t*)journal;
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < offsetof(jobJournal_t, checksum); i++)
+        hash = (hash ^ data[i]) * 16777619UL;
+    return hash;
+}
+
+
+static bool journalValid(const jobJournal_t* journal) {
+    return journal->magic == JOURNAL_MAGIC && journal->count <= JOURNAL_MAX_JOBS &&
+        journal->checksum == journalChecksum(journal);
+}
+
+
+// mark journal as outdated, called whenever 
+// the job queue or a valve changes
+void journalUpdate() {
+    journalChanged = true;
+}
+
+
+// journal heartbeat while valves are open or jobs pending, so the 
+// downtime after a reset is measured from the last second alive and 
+// not from the last change of the job queue
+static void journalAlive(uint64_t now) {
+    static uint64_t lastAlive = 0;
+#ifdef JOURNAL_NVS
+    static uint64_t lastStored = 0;
+#endif
+    time_t utc;
+
+    if (now - lastAlive < 1000 || !rtcJournal.written || (!rtcJournal.count && !rtcJournal.openValves))
+        return;
+    lastAlive = now;
+
+    utc = getUTCTime();
+    if ((uint32_t)utc < rtcJournal.written)
+        return;  // clock stepped back
+    rtcJournal.aliveSecs = min((uint32_t)utc - rtcJournal.written, (uint32_t)0xFFFF);
+    rtcJournal.checksum = journalChecksum(&rtcJournal);
+
+#ifdef JOURNAL_NVS
+    if (now - lastStored >= JOURNAL_NVS_ALIVE_SECS * 1000) {
+        lastStored = now;
+        nvs.putBytes("journal", &rtcJournal, sizeof(rtcJournal));
+    }
+#endif
+}
+
+
+// write current job queue and open valves to journal if
+// changed, called once per loop after scheduled jobs ran
+void journalSync() {
+    static valvejob_t jobs[JOURNAL_MAX_JOBS];
+    static bool truncated = false;
+    uint64_t now = getUptimeMillis();
+    uint16_t pending;
+    uint32_t due;
+    time_t utc;
+
+    if (!journalChanged) {
+        journalAlive(now);
+        return;
+    }
+    journalChanged = false;
+
+    utc = getUTCTime();
+    rtcJournal.magic = JOURNAL_MAGIC;
+    rtcJournal.written = (utc > 1609455600) ? utc : 0;
+    rtcJournal.openValves = relaysOpen();
+    rtcJournal.count = jobs_list(jobs, JOURNAL_MAX_JOBS);
+    rtcJournal.aliveSecs = 0;
+
+    // only earliest due jobs are kept, reported once per overflow
+    pending = jobs_pending();
+    if (pending > rtcJournal.count && !truncated) {
+        Serial.printf("Journal: %d of %d pending jobs kept\n", rtcJournal.count, pending);
+        logMsg("journal, pending jobs truncated");
+    }
+    truncated = (pending > rtcJournal.count);
+
+    for (uint16_t i = 0; i < rtcJournal.count; i++) {
+        due = (jobs[i].time > now) ? ((jobs[i].time - now) / 100) : 0;
+        if (due > 0x3FFFFFF)
+            due = 0x3FFFFFF;
+        rtcJournal.records[i] = (due << 6) | (jobs[i].state ? 0x20 : 0) | (jobs[i].relay & 0x1F);
+    }
+    rtcJournal.checksum = journalChecksum(&rtcJournal);
+
+#ifdef JOURNAL_NVS
+    nvs.putBytes("journal", &rtcJournal, sizeof(rtcJournal));
+#endif
+}
+
+
+// remaining time of journal record in ms after given time
+// since the journal was written
+static int64_t recordRemaining(uint32_t record, uint32_t elapsedMillis) {
+    return (int64_t)(record >> 6) * 100 - elapsedMillis;
+}
+
+
+// reconcile valves and pending jobs after a reset
+// an irrigation sequence is only resumed after an unexpected
+// reset if the system was down for less than JOURNAL_RESUME_SECS
+void journalRecover(rstcodes mode) {
+    jobJournal_t journal;
+    uint32_t record, downSecs = 0, elapsedSecs = 0, closing = 0;
+    uint8_t relay, resumed = 0;
+    uint64_t now;
+    int64_t remaining, closeRemaining;
+    bool resume = false, timeKnown = false;
+    char logmsg[64];
+    time_t utc;
+
+    memcpy(&journal, &rtcJournal, sizeof(journal));
+#ifdef JOURNAL_NVS
+    if (!journalValid(&journal))
+        nvs.getBytes("journal", &journal, sizeof(journal));
+#endif
+    memset(&rtcJournal, 0, sizeof(rtcJournal));
+#ifdef JOURNAL_NVS
+    nvs.putBytes("journal", &rtcJournal, sizeof(rtcJournal));
+#endif
+
+    if (!journalValid(&journal) || (!journal.count && !journal.openValves))
+        return;
+
+    utc = getUTCTime();
+    if (journal.written > 0 && utc > 1609455600 && 
+            (uint32_t)utc >= journal.written + journal.aliveSecs) {
+        elapsedSecs = utc - journal.written;
+        downSecs = elapsedSecs - journal.aliveSecs;
+        timeKnown = true;
+    }
+    resume = (mode == EXCEPTION || mode == WATCHDOG || mode == BROWNOUT) &&
+        timeKnown && downSecs <= JOURNAL_RESUME_SECS;
+
+    // all relays have been switched off by initRelays()
+    for (relay = 1; relay < 32; relay++) {
+        if (journal.openValves & (1UL << relay)) {
+            Serial.printf("Journal: %s was open during reset\n", pinnames[relay]);
+            sprintf(logmsg, "journal, %s interrupted", pinnames[relay]);
+            logMsg(logmsg);
+        }
+    }
+
+    if (!resume) {
+        Serial.printf("Journal: %d pending job(s) dropped\n", journal.count);
+        sprintf(logmsg, "journal, %d jobs dropped", journal.count);
+        logMsg(logmsg);
+        return;
+    }
+
+    // sort records by deadline to pair open and close jobs
+    for (uint16_t i = 1; i < journal.count; i++) {
+        for (uint16_t j = i; j > 0 && (journal.records[j-1] >> 6) > (journal.records[j] >> 6); j--) {
+            record = journal.records[j];
+            journal.records[j] = journal.records[j-1];
+            journal.records[j-1] = record;
+        }
+    }
+
+    now = getUptimeMillis();
+    for (uint16_t i = 0; i < journal.count; i++) {
+        record = journal.records[i];
+        relay = record & 0x1F;
+        if (relay == 0 || relay > NUM_RELAY)
+            continue;
+        remaining = recordRemaining(record, elapsedSecs * 1000);
+
+        if (record & 0x20) {
+            // pending valve run, skipped if it would have ended during downtime
+            for (uint16_t j = i + 1; j < journal.count; j++) {
+                if ((journal.records[j] & 0x3F) == relay && !(closing & (1UL << j))) {
+                    closeRemaining = recordRemaining(journal.records[j], elapsedSecs * 1000);
+                    closing |= (1UL << j);
+                    if (closeRemaining > 0) {
+                        schedule_job(now + (remaining > 0 ? remaining : 0), setRelay, relay, true, JOB_PROGRAM);
+                        schedule_job(now + closeRemaining, setRelay, relay, false, JOB_PROGRAM);
+                        resumed++;
+                    }
+                    break;
+                }
+            }
+        } else if (!(closing & (1UL << i)) && (journal.openValves & (1UL << relay)) && remaining > 0) {
+            // reopen valve interrupted by reset for remaining time
+            schedule_job(now, setRelay, relay, true, JOB_PROGRAM);
+            schedule_job(now + remaining, setRelay, relay, false, JOB_PROGRAM);
+            resumed++;
+        }
+    }
+
+    journalSync();
+    Serial.printf("Journal: %d valve run(s) resumed after %d secs downtime\n", resumed, downSecs);
+    sprintf(logmsg, "journal, %d runs resumed, down %ds", resumed, downSecs);
+    logMsg(logmsg);
+}
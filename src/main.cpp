@@ -29,6 +29,9 @@
 #include "relay.h"
 #include "web.h"
 #include "scheduler.h"
+#include "programs.h"
+#include "journal.h"
+#include "usage.h"
 
 void setup() {
     char logmsg[96];
@@ -61,15 +64,20 @@ void setup() {
 
     initLogging();    
     logMsg(logmsg);
+    initUsage();
+
+    // reconcile valves and pending jobs 
+    // after unexpected reset (e.g. watchdog)
+    journalRecover(runmode);
     
     initSensors();
 #ifdef HAS_HTU21D
-    readTemp(true, true); 
+    reportTemp(true, true); 
 #endif
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-    readWaterLevel(true, true);
+    reportWaterLevel(true, true);
 #endif
-    readMoisture(true, true, true);
+    reportMoisture(true, true);
 
     // check wifi uplink
     // if not available start AP
@@ -87,19 +95,19 @@ void setup() {
 
 
 void loop() {
-    static uint32_t prevLoopTimer = 0;
-    static uint32_t prevMqttPublish = 0;
+    static uint64_t prevLoopTimer = 0;
+    static uint64_t prevMqttPublish = 0;
     static uint32_t wifiRetry = WIFI_STA_RECONNECT_TIMEOUT;
     static uint16_t wifiOffline = 0;
-    uint32_t scheduler_start = 0;
+    bool relaysChanged;
 
 #ifdef DEBUG_MEMORY
     static char logmsg[32];
 #endif
 
     // run tasks once every second
-    if (millis() - prevLoopTimer >= 1000) { 
-        prevLoopTimer = millis();
+    if (getUptimeMillis() - prevLoopTimer >= 1000) { 
+        prevLoopTimer = getUptimeMillis();
         busyTime += 1;
 
         // check for wifi uplink, try to reconnect every 60 secs.
@@ -130,10 +138,14 @@ void loop() {
             if (mqtt_connect(MQTT_TIMEOUT_MS))
                 mqtt.loop();
 
-            // publish current sensor readings
-            if (millis() - prevMqttPublish >= (generalPrefs.mqttPushInterval * 1000)) {
-                prevMqttPublish = millis();
-                mqtt_send(MQTT_TIMEOUT_MS);
+            // publish current sensor readings, relay changes right away
+            // and retried every second until they have been published
+            relaysChanged = relayPublishDue();
+            if (relaysChanged ||
+                    getUptimeMillis() - prevMqttPublish >= (generalPrefs.mqttPushInterval * 1000)) {
+                prevMqttPublish = getUptimeMillis();
+                if (!mqtt_send(MQTT_TIMEOUT_MS) && relaysChanged)
+                    relayPublishRetry();
             }
 
             // retry ntp sync every minute if time is not set
@@ -142,9 +154,9 @@ void loop() {
 
             // log sensor readings every hour
             if (!(busyTime % 3600)) {
-                readTemp(true, true);
-                readWaterLevel(true, true);
-                readMoisture(true, true, false);  
+                reportTemp(true, true);
+                reportWaterLevel(true, true);
+                reportMoisture(true, true);
             }
 
             // sync RTC, check for log rotation
@@ -158,34 +170,22 @@ void loop() {
         if (!(busyTime % 5) && busyTime >= AP_TIMEOUT_SECS && wifi_uplink(false))
             wifi_hotspot(false);
 
-        // read sensors
-        if (!(busyTime % 15)) {
-            readTemp(true, false);
-            readWaterLevel(true, false);
-            readMoisture(true, false, false); // updates moving avg if enabled
+        // show latest sensor readings (sampled by sensor task)
+        if (!(busyTime % SENSOR_REPORT_SECS)) {
+            reportTemp(true, false);
+            reportWaterLevel(true, false);
+            reportMoisture(true, false);
         }
 
-        // daily irrigation scheduler (fall back watering)
-        // triggers consecutive valve jobs at given time (HH:MM)
-        if (switchesPrefs.enableAutoIrrigation && !jobs_scheduled() && 
-                !strcmp(switchesPrefs.autoIrrigationTime, getTimeString(false))) {
-            scheduler_start = millis();
-            for (uint8_t i = 1, j = 0; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++) {
-                // only schedule valve if it hasn't been used within given time range to avoid overwatering
-                if ((getLocalTime() - pintime[i]) > (switchesPrefs.autoIrrigationPauseHours * 3600)) {
-                    if (switchesPrefs.autoIrrigationSecs[i-1] > 0) {
-                        // schedule a start and stop job for a valve with configured runtime
-                        schedule_job(&valvejobs[j], (scheduler_start + (i * 1000)), setRelay, i, true);
-                        schedule_job(&valvejobs[j+1], (scheduler_start + (i + switchesPrefs.autoIrrigationSecs[i-1]) * 1000), setRelay, i, false);
-                        scheduler_start = scheduler_start + ((i + switchesPrefs.autoIrrigationSecs[i-1]) * 1000) + 5000;
-                        j = j + 2;
-                    }
-                }
-            }
-        }
+        // irrigation programs (fall back watering)
+        // trigger consecutive valve jobs at given times
+        programScheduler();
 
         unblockRelays();
         pumpAutoStop();
+#ifdef DEBUG_INTERLOCKS
+        checkInterlocks();
+#endif
 
 #ifdef DEBUG_MEMORY
         if (!(busyTime % 300))
@@ -194,6 +194,10 @@ void loop() {
     }
 
     webserver.handleClient(); // handle webserver requests
+    pumpMonitor(); // check pump current
+    relayCommands(); // manual relay commands
     scheduler(); // trigger scheduled jobs
+    logRelayEvents(); // log and publish relay changes
+    journalSync(); // keep track of pending jobs
     esp_task_wdt_reset(); // feed the dog...
 }
@@ -27,19 +27,61 @@
 #include "sensors.h"
 #include "relay.h"
 #include "utils.h"
+#include "programs.h"
 
 
 WiFiClient wifi;
 PubSubClient mqtt(wifi);
 static char clientname[64];
 
+// publish upcoming valve events as JSON array to <state topic>/preview,
+// events are generated twice (length, payload) to avoid buffering them
+static bool mqtt_preview(uint16_t n) {
+    static schedulePreview_t preview, start;
+    static char topic[80], buf[112];
+    previewEvent_t ev;
+    uint32_t len = 2;
+    uint16_t i;
+
+    previewBegin(&start);
+    preview = start;
+    for (i = 0; i < n && previewNext(&preview, &ev); i++)
+        len += previewEventString(&ev, buf, sizeof(buf)) + (i > 0 ? 1 : 0);
+
+    snprintf(topic, sizeof(topic)-1, "%s/preview", generalPrefs.mqttTopicState);
+    if (!mqtt.beginPublish(topic, len, false))
+        return false;
+    mqtt.write('[');
+    preview = start;
+    for (i = 0; i < n && previewNext(&preview, &ev); i++) {
+        if (i > 0)
+            mqtt.write(',');
+        mqtt.write((uint8_t*)buf, previewEventString(&ev, buf, sizeof(buf)));
+    }
+    mqtt.write(']');
+    return mqtt.endPublish();
+}
+
+
 // called if mqtt messages arrive on topics we've subscribed
 static void mqtt_callback(char* topic, byte* payload, unsigned int length) {
+    char buf[8];
+
     if (strstr(topic, generalPrefs.mqttTopicCmd) != NULL) {
-        for (uint8_t i = 1; i < (sizeof(pinmap)/sizeof(pinmap[0])); i++) {
-            if (strstr(topic, pinnames[i])) {
-                setRelay(i, strncmp((char*) payload, "on", length) == 0);
-                mqtt_send(MQTT_TIMEOUT_MS);
+        // payload is number of events
+        if (strstr(topic, "/preview") != NULL) {
+            if (length >= sizeof(buf))
+                length = sizeof(buf) - 1;
+            strncpy(buf, (char*)payload, length);
+            buf[length] = '\0';
+            mqtt_preview(length ? constrain(atoi(buf), 0, PREVIEW_MAX_EVENTS) : PREVIEW_DEFAULT_EVENTS);
+            return;
+        }
+        // match whole topic level, valve1 is a prefix of valve10
+        const char* name = strrchr(topic, '/');
+        for (uint8_t i = 1; name != NULL && i <= NUM_RELAY; i++) {
+            if (strcmp(name + 1, pinnames[i]) == 0) {
+                requestRelay(i, strncmp((char*) payload, "on", length) == 0);
             }
         }
     }
@@ -99,7 +141,7 @@ bool mqtt_connect(uint16_t timeoutMillis) {
     if (mqtt.connected()) {
         Serial.println(F("success!"));
         // subscribe to cmd topics for remote valve switching
-        for (uint8_t i = 1; i < (sizeof(pinmap)/sizeof(pinmap[0])); i++) {
+        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
             snprintf(buf, sizeof(buf)-1, "%s/%s", generalPrefs.mqttTopicCmd, pinnames[i]);
             if (!mqtt.subscribe(buf)) {
                 Serial.print(millis());
@@ -108,6 +150,8 @@ bool mqtt_connect(uint16_t timeoutMillis) {
                 logMsg(logmsg);
             }
         }
+        snprintf(buf, sizeof(buf)-1, "%s/preview", generalPrefs.mqttTopicCmd);
+        mqtt.subscribe(buf);
         return true;
     } else {
         lastFail = millis();
@@ -122,8 +166,10 @@ bool mqtt_connect(uint16_t timeoutMillis) {
 // try to publish sensor reedings with given timeout 
 // will implicitly call mqtt_init()
 bool mqtt_send(uint16_t timeoutMillis) {
-    StaticJsonDocument<384> JSON;
-    static char status[64], topic[64], buf[192], label[16];
+    StaticJsonDocument<304 + (NUM_RELAY + 1) * 16> JSON;
+    static char topic[64], buf[240 + (NUM_RELAY + 1) * 16], label[16];
+    uint32_t coalesced, deferred, samples, saved;
+    sensorReadings_t sensors = sensorSnapshot();
 
     if (!wifi_uplink(false)) {
         Serial.print(millis());
@@ -133,16 +179,23 @@ bool mqtt_send(uint16_t timeoutMillis) {
     }
 
     // create JSON with relay status and sensor readings
-    relayStatus(status, sizeof(status));
-    deserializeJson(JSON, status);
+    for (uint8_t i = 0; i <= NUM_RELAY; i++)
+        JSON[pinnames[i]] = relayStatusCode(i);
+    relayCommandStats(&coalesced, &deferred);
+    JSON["coalesced"] = coalesced;
+    JSON["deferred"] = deferred;
+    sensorSamples(&samples, &saved);
+    JSON["samples"] = samples;
+    JSON["saved"] = saved;
 #ifdef HAS_HTU21D
-    readTemp(false, false);
     JSON["temp"] = sensors.temperature;
     JSON["hum"] = sensors.humidity;
 #endif
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-    readWaterLevel(false, false);
     JSON["level"] = sensors.waterLevel;
+#endif
+#ifdef PUMP_CURRENT_PIN
+    JSON["current"] = sensors.pumpCurrent;
 #endif
     for (uint8_t i = 0; i < NUM_MOISTURE_SENSORS; i++) {
         // don't send raw sensor values
@@ -156,7 +209,8 @@ bool mqtt_send(uint16_t timeoutMillis) {
     if (mqtt_connect(timeoutMillis)) {
         snprintf(topic, sizeof(topic)-1, "%s", generalPrefs.mqttTopicState);
         Serial.print(millis());
-        if (mqtt.publish(topic, buf, s)) {
+        // streamed, payload may exceed client's packet buffer with many valves
+        if (mqtt.beginPublish(topic, s, false) && mqtt.write((uint8_t*)buf, s) == s && mqtt.endPublish()) {
             Serial.printf(": MQTT: published %d bytes to %s on %s\n", s, 
                 generalPrefs.mqttTopicState, generalPrefs.mqttBroker);
             return true;
@@ -24,6 +24,9 @@
 #include "utils.h"
 #include "sensors.h"
 
+// converts "HH:MM" to minutes after midnight at compile time
+#define HHMM_TO_MINS(t) ((((t)[0]-'0')*10 + ((t)[1]-'0'))*60 + ((t)[3]-'0')*10 + ((t)[4]-'0'))
+
 // instantiate general settings and set default values
 RTC_DATA_ATTR generalPrefs_t generalPrefs = {
     AP_TIMEOUT_SECS,
@@ -55,9 +58,18 @@ RTC_DATA_ATTR generalPrefs_t generalPrefs = {
 #endif
 };
 
+// defaults for the valves listed in config.h, further valves
+// (NUM_RELAY > 4) are disabled until a pin has been assigned
+static const int8_t relayPins[] = { RELAY1_PIN, RELAY2_PIN, RELAY3_PIN, RELAY4_PIN };
+static const char* relayLabels[] = { RELAY1_LABEL, RELAY2_LABEL, RELAY3_LABEL, RELAY4_LABEL };
+static const uint16_t relayFlows[] = { RELAY1_FLOW, RELAY2_FLOW, RELAY3_FLOW, RELAY4_FLOW };
+static const uint16_t relayRates[] = { RELAY1_RATE, RELAY2_RATE, RELAY3_RATE, RELAY4_RATE };
+#define RELAY_DEFAULTS (sizeof(relayPins) / sizeof(relayPins[0]))
+
+// per valve settings are set by relayDefaults()
 RTC_DATA_ATTR switchesPrefs_t switchesPrefs = {
-    { RELAY1_PIN, RELAY2_PIN, RELAY3_PIN, RELAY4_PIN },
-    { RELAY1_LABEL, RELAY2_LABEL, RELAY3_LABEL, RELAY4_LABEL},
+    { 0 },
+    { "" },
     { MOIST1_PIN, MOIST2_PIN, MOIST3_PIN, MOIST4_PIN },
     { MOIST1_LABEL, MOIST2_LABEL, MOIST3_LABEL, MOIST4_LABEL},
     PUMP_PIN,
@@ -65,13 +77,21 @@ RTC_DATA_ATTR switchesPrefs_t switchesPrefs = {
     RELAY_BLOCK_MINS,
 #ifdef ENABLE_AUTO_IRRIGRATION
     true,
-    AUTO_IRRIGRATION_TIME,
-    { AUTO_IRRIGATION_SECS, AUTO_IRRIGATION_SECS, AUTO_IRRIGATION_SECS, AUTO_IRRIGATION_SECS },
+    {
+        { true, AUTO_IRRIGATION_WEEKDAYS, { HHMM_TO_MINS(AUTO_IRRIGRATION_TIME), -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } }
+    },
     AUTO_IRRIGATION_PAUSE_HOURS,
 #else
     false,
-    "none",
-    0,
+    {
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } },
+        { false, 0x7F, { -1, -1, -1, -1 }, { 0 } }
+    },
     0,
 #endif
 #ifdef ENABLE_LOGGING
@@ -85,7 +105,10 @@ RTC_DATA_ATTR switchesPrefs_t switchesPrefs = {
     MOISTURE_VALUE_AIR,
     MOISTURE_VALUE_WATER,
     false,
-    true
+    true,
+    PUMP_CAPACITY,
+    { 0 },
+    { 0 }
 };
 
 // use NVS to store settings to survive
@@ -93,8 +116,32 @@ RTC_DATA_ATTR switchesPrefs_t switchesPrefs = {
 Preferences nvs;
 
 
-// initialize NVS to (permanently) store system settings
+// set default pin, label and flow of all valves
+static void relayDefaults() {
+    for (uint8_t i = 0; i < NUM_RELAY; i++) {
+        if (i < RELAY_DEFAULTS) {
+            switchesPrefs.pinRelay[i] = relayPins[i];
+            strncpy(switchesPrefs.labelRelay[i], relayLabels[i], 24);
+            switchesPrefs.flowRelay[i] = relayFlows[i];
+            switchesPrefs.rateRelay[i] = relayRates[i];
+        } else {
+            switchesPrefs.pinRelay[i] = -1;
+            sprintf(switchesPrefs.labelRelay[i], "valve%d", i + 1);
+        }
+#ifdef ENABLE_AUTO_IRRIGRATION
+        if (switchesPrefs.pinRelay[i] >= 0)
+            switchesPrefs.irrigationPrograms[0].secs[i] = AUTO_IRRIGATION_SECS;
+#endif
+    }
+}
+
+
+// initialize NVS to (permanently) store system settings, valve 
+// defaults are only set on power up (settings kept in RTC memory
+// on restart, labels are never empty once set)
 void initPrefs() {
+    if (!switchesPrefs.labelRelay[0][0])
+        relayDefaults();
     nvs.begin("prefs", false);
 }
 
@@ -114,9 +161,15 @@ void restorePrefs() {
     }
     
 	if (nvs.getBool("switches")) {
-        prefSize = nvs.getBytesLength("switchesPrefs");
+        prefSize = nvs.getBytesLength(SWITCHES_PREFS_KEY);
+        if (prefSize > sizeof(switchesPrefs)) {
+            Serial.print("Switches preferences don't match firmware (");
+            Serial.print(prefSize);
+            Serial.println(" bytes), using defaults.");
+            return;
+        }
         byte bufSwitchesPrefs[prefSize];
-        nvs.getBytes("switchesPrefs", bufSwitchesPrefs, prefSize);
+        nvs.getBytes(SWITCHES_PREFS_KEY, bufSwitchesPrefs, prefSize);
         memcpy(&switchesPrefs, bufSwitchesPrefs, prefSize);
         Serial.print("Restored switches preferences (");
         Serial.print(prefSize);
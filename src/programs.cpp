@@ -0,0 +1,538 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "config.h"
+#include "programs.h"
+#include "scheduler.h"
+#include "relay.h"
+#include "rtc.h"
+#include "logging.h"
+
+// next start of each program (UTC), 0 if program is inactive
+static time_t nextStart[MAX_PROGRAMS];
+
+// active programs sorted by next start, first one is due next
+static uint8_t programQueue[MAX_PROGRAMS];
+static uint8_t numPrograms = 0;
+static bool programsInited = false;
+static time_t lastCheck = 0;
+
+
+// returns first start (UTC) of program after given time or 0
+static time_t findNextStart(const irrigationProgram_t* prog, time_t after) {
+    time_t midnight, start, first = 0;
+    uint8_t weekday;
+
+    if (!prog->enabled || !(prog->weekdays & 0x7F))
+        return 0;
+
+    midnight = utcToLocal(after);
+    midnight -= midnight % 86400;
+
+    // a week ahead to catch starts on the same weekday
+    for (uint8_t d = 0; d <= 7 && !first; d++) {
+        weekday = ((midnight / 86400) + d + 4) % 7;  // 01/01/1970 was a thursday
+        if (!(prog->weekdays & (1 << weekday)))
+            continue;
+        for (uint8_t i = 0; i < MAX_PROGRAM_STARTS; i++) {
+            if (prog->starts[i] < 0)
+                continue;
+            start = localToUTC(midnight + d * 86400 + prog->starts[i] * 60);
+            if (start > after && (!first || start < first))
+                first = start;
+        }
+    }
+    return first;
+}
+
+
+// insert program into queue sorted by next start
+static void queueProgram(uint8_t prog) {
+    uint8_t i = numPrograms;
+
+    if (!nextStart[prog])
+        return;
+    while (i > 0 && nextStart[programQueue[i-1]] > nextStart[prog]) {
+        programQueue[i] = programQueue[i-1];
+        i--;
+    }
+    programQueue[i] = prog;
+    numPrograms++;
+}
+
+
+// plan valve runs of program leaving out valves in skip mask; without pump
+// capacity valves run one after another, otherwise valves are packed first-fit
+// into groups whose total flow fits the pump and all valves of a group run at
+// the same time; returns number of runs ordered by group and valve
+static uint8_t planProgram(const irrigationProgram_t* program, uint32_t skip, valveRun_t* runs) {
+    uint16_t groupFlow[NUM_RELAY];
+    uint8_t group[NUM_RELAY + 1], first[NUM_RELAY];
+    uint8_t numGroups = 0, n = 0, g;
+    uint32_t start = 0, end;
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (!program->secs[i-1] || (skip & (1UL << i)))
+            continue;
+        for (g = 0; g < numGroups; g++) {
+            if (switchesPrefs.pumpCapacity && 
+                    (groupFlow[g] + valveFlow(i)) <= switchesPrefs.pumpCapacity)
+                break;
+        }
+        if (g == numGroups) {
+            groupFlow[numGroups] = 0;
+            first[numGroups++] = i;
+        }
+        groupFlow[g] += valveFlow(i);
+        group[i] = g;
+    }
+
+    // next group starts ZONE_GAP_SECS after all valves of previous group have been closed
+    for (g = 0; g < numGroups; g++) {
+        end = start;
+        for (uint8_t i = first[g]; i <= NUM_RELAY; i++) {
+            if (!program->secs[i-1] || (skip & (1UL << i)) || group[i] != g)
+                continue;
+            runs[n].relay = i;
+            runs[n].open = start;
+            runs[n].close = runs[n].open + program->secs[i-1];
+            if (runs[n].close > end)
+                end = runs[n].close;
+            n++;
+        }
+        start = end + ZONE_GAP_SECS;
+    }
+    return n;
+}
+
+
+// schedule valve jobs for given program
+static void startProgram(uint8_t prog) {
+    const irrigationProgram_t* program = &switchesPrefs.irrigationPrograms[prog];
+    uint64_t scheduler_start = getUptimeMillis();
+    valveRun_t runs[NUM_RELAY];
+    jobhandle_t job;
+    uint32_t skip = 0;
+    uint8_t valves = 0, n;
+    char logmsg[32];
+
+    // only schedule valve if it hasn't been used within given time range to avoid overwatering
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if ((getLocalTime() - pintime[i]) <= (switchesPrefs.autoIrrigationPauseHours * 3600))
+            skip |= (1UL << i);
+    }
+
+    // schedule a start and stop job for each valve with configured runtime
+    n = planProgram(program, skip, runs);
+    for (uint8_t i = 0; i < n; i++) {
+        job = schedule_job(scheduler_start + runs[i].open * 1000ULL, setRelay, runs[i].relay, true, JOB_PROGRAM);
+        if (job != JOB_INVALID && !schedule_job(scheduler_start + runs[i].close * 1000ULL, setRelay, runs[i].relay, false, JOB_PROGRAM))
+            cancel_job(job);  // never open a valve without closing it
+        else if (job != JOB_INVALID)
+            valves++;
+    }
+
+    Serial.print(millis());
+    Serial.printf(": Program %d started, %d valve(s) scheduled\n", prog + 1, valves);
+    sprintf(logmsg, "program %d, %d valves", prog + 1, valves);
+    logMsg(logmsg);
+}
+
+
+// (re)calculate next start of all programs, 
+// must be called if programs have been changed
+void updatePrograms() {
+    time_t now;
+
+    now = getUTCTime();
+    numPrograms = 0;
+    for (uint8_t i = 0; i < MAX_PROGRAMS; i++) {
+        nextStart[i] = findNextStart(&switchesPrefs.irrigationPrograms[i], now);
+        queueProgram(i);
+    }
+    programsInited = true;
+    lastCheck = now;
+
+    if (numPrograms > 0) {
+        Serial.print(millis());
+        Serial.printf(": Next irrigation program %d in %ld min.\n", programQueue[0] + 1,
+            (long)(nextStart[programQueue[0]] - now) / 60);
+    }
+}
+
+
+// check if earliest program is due, a program which
+// becomes due while valve jobs are still pending is 
+// deferred until the previous sequence has finished
+void programScheduler() {
+    time_t now;
+    uint8_t prog;
+
+    now = getUTCTime();
+    if (!switchesPrefs.enableAutoIrrigation || now < 1609455600)  // RTC not set yet
+        return;
+
+    // system time has been set back
+    if (!programsInited || now < lastCheck)
+        updatePrograms();
+    lastCheck = now;
+
+    if (!numPrograms || now < nextStart[programQueue[0]] || jobs_scheduled())
+        return;
+
+    prog = programQueue[0];
+    memmove(&programQueue[0], &programQueue[1], --numPrograms);
+    startProgram(prog);
+    nextStart[prog] = findNextStart(&switchesPrefs.irrigationPrograms[prog], now);
+    queueProgram(prog);
+}
+
+
+// returns next start of program (UTC) or 0 if inactive
+time_t nextProgramStart(uint8_t prog) {
+    if (prog >= MAX_PROGRAMS || !programsInited)
+        return 0;
+    return nextStart[prog];
+}
+
+
+// returns start times of program as comma separated list (HH:MM,HH:MM)
+char* programStartsString(uint8_t prog) {
+    static char str[MAX_PROGRAM_STARTS * 6];
+    int16_t start;
+
+    memset(str, 0, sizeof(str));
+    for (uint8_t i = 0; i < MAX_PROGRAM_STARTS; i++) {
+        start = switchesPrefs.irrigationPrograms[prog].starts[i];
+        if (start >= 0)
+            sprintf(str + strlen(str), "%s%.2d:%.2d", strlen(str) ? "," : "", start / 60, start % 60);
+    }
+    return str;
+}
+
+
+// set start times of program from comma separated list (HH:MM,HH:MM)
+// program remains unchanged if list contains an invalid time
+bool parseProgramStarts(irrigationProgram_t* prog, const char* str) {
+    int16_t starts[MAX_PROGRAM_STARTS], tmp;
+    uint8_t n = 0, hh, mm;
+
+    while (*str) {
+        if (n >= MAX_PROGRAM_STARTS || !isdigit(str[0]) || !isdigit(str[1]) || str[2] != ':' ||
+                !isdigit(str[3]) || !isdigit(str[4]) || (str[5] != ',' && str[5] != '\0'))
+            return false;
+        hh = (str[0] - '0') * 10 + (str[1] - '0');
+        mm = (str[3] - '0') * 10 + (str[4] - '0');
+        if (hh > 23 || mm > 59)
+            return false;
+        starts[n++] = hh * 60 + mm;
+        str += (str[5] == ',') ? 6 : 5;
+    }
+    if (!n)
+        return false;
+
+    // keep start times in ascending order
+    for (uint8_t i = 1; i < n; i++) {
+        for (uint8_t j = i; j > 0 && starts[j-1] > starts[j]; j--) {
+            tmp = starts[j];
+            starts[j] = starts[j-1];
+            starts[j-1] = tmp;
+        }
+    }
+    for (uint8_t i = 0; i < MAX_PROGRAM_STARTS; i++)
+        prog->starts[i] = (i < n) ? starts[i] : -1;
+    return true;
+}
+
+
+// init lazy preview of upcoming valve events, starts
+// with jobs already queued followed by irrigation programs
+void previewBegin(schedulePreview_t* p) {
+    time_t offset;
+
+    memset(p, 0, sizeof(schedulePreview_t));
+    p->now = getUTCTime();
+    offset = getLocalTime() - p->now;  // pintime[] is local time
+    for (uint8_t i = 1; i <= NUM_RELAY; i++)
+        p->lastUse[i] = pintime[i] ? pintime[i] - offset : 0;
+    for (uint8_t i = 0; i < MAX_PROGRAMS; i++) {
+        if (switchesPrefs.enableAutoIrrigation && p->now >= 1609455600)
+            p->nextStart[i] = findNextStart(&switchesPrefs.irrigationPrograms[i], p->now);
+    }
+    p->busyUntil = p->now;
+    p->until = p->now + PREVIEW_MAX_DAYS * 86400;
+    p->prog = MAX_PROGRAMS;
+    p->queued = true;
+}
+
+
+// simulate opening or closing a valve at given time
+static void previewValve(schedulePreview_t* p, previewEvent_t* ev, time_t t, uint8_t relay, bool state) {
+    ev->time = t;
+    ev->relay = relay;
+    ev->state = state;
+    if (state) {
+        if (p->lastUse[relay] > 0 &&
+                (t - p->lastUse[relay]) <= (time_t)(switchesPrefs.relaysBlockMins * 60))
+            p->blocked |= (1UL << relay);
+        else
+            p->blocked &= ~(1UL << relay);
+    } else if (!(p->blocked & (1UL << relay))) {
+        p->lastUse[relay] = t;
+    }
+    ev->blocked = (p->blocked & (1UL << relay)) != 0;
+}
+
+
+// returns next upcoming valve event, false if there are no more events
+bool previewNext(schedulePreview_t* p, previewEvent_t* ev) {
+    uint64_t uptime;
+    uint32_t skip, t, nextTime = 0;
+    uint8_t next;
+
+    // jobs already in queue come first
+    if (p->queued) {
+        if (jobs_next(&p->job)) {
+            uptime = getUptimeMillis();
+            ev->prog = 0;
+            previewValve(p, ev, p->now + (time_t)((p->job.time > uptime ? p->job.time - uptime : 0) / 1000),
+                p->job.relay, p->job.state);
+            if (ev->time > p->busyUntil)
+                p->busyUntil = ev->time;
+            return true;
+        }
+        p->queued = false;
+    }
+
+    while (true) {
+        // next open or close of running program in time order
+        if (p->prog < MAX_PROGRAMS) {
+            next = p->numRuns;
+            for (uint8_t i = 0; i < p->numRuns; i++) {
+                if (p->closed & (1UL << i))
+                    continue;
+                t = (p->opened & (1UL << i)) ? p->runs[i].close : p->runs[i].open;
+                if (next == p->numRuns || t < nextTime) {
+                    next = i;
+                    nextTime = t;
+                }
+            }
+            if (next < p->numRuns) {
+                ev->prog = p->prog + 1;
+                if (!(p->opened & (1UL << next))) {
+                    previewValve(p, ev, p->seqStart + nextTime, p->runs[next].relay, true);
+                    p->opened |= (1UL << next);
+                } else {
+                    previewValve(p, ev, p->seqStart + nextTime, p->runs[next].relay, false);
+                    p->closed |= (1UL << next);
+                    if (ev->time > p->busyUntil)
+                        p->busyUntil = ev->time;
+                }
+                return true;
+            }
+            p->prog = MAX_PROGRAMS;
+        }
+
+        // start earliest program, deferred while previous jobs are pending
+        for (uint8_t i = 0; i < MAX_PROGRAMS; i++) {
+            if (p->nextStart[i] && (p->prog == MAX_PROGRAMS || p->nextStart[i] < p->nextStart[p->prog]))
+                p->prog = i;
+        }
+        if (p->prog == MAX_PROGRAMS || p->nextStart[p->prog] > p->until)
+            return false;
+        p->now = max(p->nextStart[p->prog], p->busyUntil);
+        p->seqStart = p->now;
+        p->nextStart[p->prog] = findNextStart(&switchesPrefs.irrigationPrograms[p->prog], p->now);
+
+        // valves used within autoIrrigationPauseHours are skipped
+        skip = 0;
+        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+            if ((p->now - p->lastUse[i]) <= (time_t)(switchesPrefs.autoIrrigationPauseHours * 3600))
+                skip |= (1UL << i);
+        }
+        p->numRuns = planProgram(&switchesPrefs.irrigationPrograms[p->prog], skip, p->runs);
+        p->opened = 0;
+        p->closed = 0;
+    }
+}
+
+
+// format preview event as JSON object
+uint16_t previewEventString(const previewEvent_t* ev, char* buf, size_t s) {
+    return snprintf(buf, s, "{\"time\":%ld,\"program\":%d,\"valve\":\"%s\",\"state\":%d,\"blocked\":%d}",
+        (long)ev->time, ev->prog, pinnames[ev->relay], ev->state ? 1 : 0, ev->blocked ? 1 : 0);
+}
+
+
+// program start within simulated weeks, see checkPrograms()
+typedef struct {
+    uint32_t time;  // secs since sunday 00:00 of first week
+    uint8_t prog;
+    int16_t start;
+} programRun_t;
+
+
+// order program runs by start time, programs with same start by number
+static int compareRuns(const void* a, const void* b) {
+    const programRun_t* ra = (const programRun_t*)a;
+    const programRun_t* rb = (const programRun_t*)b;
+
+    if (ra->time != rb->time)
+        return (ra->time < rb->time) ? -1 : 1;
+    return ra->prog - rb->prog;
+}
+
+
+// record conflict, same conflict on different weekdays is merged;
+// returns new number of conflicts, max + 1 once the array is full
+static uint8_t addConflict(programConflict_t* conflicts, uint8_t n, uint8_t max, uint8_t kind,
+        const programRun_t* run, uint8_t relay, uint8_t other) {
+    uint8_t weekday = (run->time / 86400) % 7;
+
+    for (uint8_t i = 0; i < n && i < max; i++) {
+        if (conflicts[i].kind == kind && conflicts[i].prog == run->prog + 1 &&
+                conflicts[i].start == run->start && conflicts[i].relay == relay) {
+            conflicts[i].weekdays |= (1 << weekday);
+            return n;
+        }
+    }
+    if (n >= max)
+        return (max < UINT8_MAX) ? max + 1 : max;  // conflict dropped
+
+    conflicts[n].kind = kind;
+    conflicts[n].prog = run->prog + 1;
+    conflicts[n].start = run->start;
+    conflicts[n].relay = relay;
+    conflicts[n].other = other;
+    conflicts[n].weekdays = (1 << weekday);
+    return n + 1;
+}
+
+
+// check all programs for valve runs which would be deferred, skipped, blocked 
+// or autostopped at runtime; program starts are sorted and swept once over two 
+// weeks (local time, no DST) like programScheduler() and startProgram() would 
+// run them, conflicts are only reported for the second week so that valve 
+// runs from the end of previous week are taken into account; returns number 
+// of conflicts stored or max + 1 if there were more than max conflicts
+uint8_t checkPrograms(programConflict_t* conflicts, uint8_t max) {
+    static programRun_t runs[MAX_PROGRAMS * MAX_PROGRAM_STARTS * 14];
+    const irrigationProgram_t* program;
+    uint32_t lastClose[NUM_RELAY + 1], lastStart[MAX_PROGRAMS];
+    valveRun_t plan[NUM_RELAY];
+    uint32_t busyUntil = 0, begin, start, open, close, used = 0, skip;
+    uint16_t numRuns = 0;
+    uint8_t n = 0, running = 0, numValves, relay;
+    bool report;
+
+    if (!switchesPrefs.enableAutoIrrigation)
+        return 0;
+
+    for (uint8_t p = 0; p < MAX_PROGRAMS; p++) {
+        program = &switchesPrefs.irrigationPrograms[p];
+        if (!program->enabled)
+            continue;
+        for (uint8_t d = 0; d < 14; d++) {
+            if (!(program->weekdays & (1 << (d % 7))))
+                continue;
+            for (uint8_t i = 0; i < MAX_PROGRAM_STARTS; i++) {
+                if (program->starts[i] < 0)
+                    continue;
+                runs[numRuns].time = d * 86400 + program->starts[i] * 60;
+                runs[numRuns].prog = p;
+                runs[numRuns++].start = program->starts[i];
+            }
+        }
+    }
+    qsort(runs, numRuns, sizeof(programRun_t), compareRuns);
+
+    memset(lastStart, 0, sizeof(lastStart));
+    for (uint16_t r = 0; r < numRuns; r++) {
+        program = &switchesPrefs.irrigationPrograms[runs[r].prog];
+        report = runs[r].time >= 7 * 86400;
+        start = runs[r].time;
+
+        // program is deferred while valve jobs are pending, 
+        // its next start is calculated after the deferred one
+        if (start < busyUntil) {
+            if (lastStart[runs[r].prog] && lastStart[runs[r].prog] >= start) {
+                if (report)
+                    n = addConflict(conflicts, n, max, CONFLICT_DROPPED, &runs[r], 0, running + 1);
+                continue;
+            }
+            if (report)
+                n = addConflict(conflicts, n, max, CONFLICT_OVERLAP, &runs[r], 0, running + 1);
+            start = busyUntil;
+        }
+        lastStart[runs[r].prog] = start;
+        begin = start;
+
+        skip = 0;
+        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+            if (program->secs[i-1] && (used & (1UL << i)) && (begin - lastClose[i]) <= 
+                    (uint32_t)(switchesPrefs.autoIrrigationPauseHours * 3600)) {
+                if (report)
+                    n = addConflict(conflicts, n, max, CONFLICT_PAUSED, &runs[r], i, 0);
+                skip |= (1UL << i);
+            }
+        }
+
+        numValves = planProgram(program, skip, plan);
+        for (uint8_t v = 0; v < numValves; v++) {
+            relay = plan[v].relay;
+            open = start + plan[v].open;
+            close = start + plan[v].close;
+            if ((used & (1UL << relay)) && (open - lastClose[relay]) <= switchesPrefs.relaysBlockMins * 60) {
+                if (report)
+                    n = addConflict(conflicts, n, max, CONFLICT_BLOCKED, &runs[r], relay, 0);
+            } else {
+                if (program->secs[relay-1] > switchesPrefs.pumpAutoStopSecs && report)
+                    n = addConflict(conflicts, n, max, CONFLICT_AUTOSTOP, &runs[r], relay, 0);
+                lastClose[relay] = close;
+                used |= (1UL << relay);
+            }
+            if (close > busyUntil)
+                busyUntil = close;
+            running = runs[r].prog;
+        }
+    }
+    return n;
+}
+
+
+// describe conflict, e.g. "program 1 06:30 (Mo,Tu): valve2 blocked"
+char* programConflictString(const programConflict_t* conflict) {
+    static char str[96];
+    const char* weekdays[] = { "Su", "Mo", "Tu", "We", "Th", "Fr", "Sa" };
+    const char* kinds[] = { "deferred,", "skipped,", "skipped (pause)", "blocked", "autostop" };
+
+    sprintf(str, "program %d %.2d:%.2d (", conflict->prog, conflict->start / 60, conflict->start % 60);
+    for (uint8_t i = 0; i < 7; i++) {
+        if (conflict->weekdays & (1 << ((i + 1) % 7)))  // monday first
+            sprintf(str + strlen(str), "%s%s", str[strlen(str) - 1] != '(' ? "," : "", weekdays[(i + 1) % 7]);
+    }
+    strcat(str, "): ");
+    if (conflict->relay > 0)
+        sprintf(str + strlen(str), "%s ", switchesPrefs.labelRelay[conflict->relay - 1]);
+    strcat(str, kinds[conflict->kind]);
+    if (conflict->kind == CONFLICT_OVERLAP || conflict->kind == CONFLICT_DROPPED)
+        sprintf(str + strlen(str), " program %d still running", conflict->other);
+    return str;
+}
@@ -23,65 +23,217 @@
 #include "sensors.h"
 #include "rtc.h"
 #include "logging.h"
-#include "mqtt.h"
 #include "relay.h"
+#include "journal.h"
+#include "hal.h"
+#include "scheduler.h"
+#include "usage.h"
+#include "currentdetect.h"
+#include <atomic>
 
-uint16_t pinstate = 0;
+// open valves are tracked as 32-bit mask and the
+// job journal stores relay numbers in 5 bits
+#if NUM_RELAY > 31
+#error "NUM_RELAY must not exceed 31"
+#endif
 
-// relay pin and relay state value
-// pin_number, state on, state blocked
-uint16_t pinmap[][3] = { 
-    { PUMP_PIN, 0x0001, 0x0002 },
-    { RELAY1_PIN, 0x0004, 0x0008 },
-    { RELAY2_PIN, 0x0010, 0x0020 },
-    { RELAY3_PIN, 0x0040, 0x0080 },
-    { RELAY4_PIN, 0x0100, 0x0200 }
-};
+// relay 0 is the pump, followed by the valves
+relaystate_t relaystate[NUM_RELAY + 1];
 
 // store time pin was last triggered
-uint32_t pintime[] = { 0, 0, 0, 0, 0 };
-
-char pinnames[5][7] = {
-    "pump",
-    "valve1",
-    "valve2",
-    "valve3",
-    "valve4"
+uint32_t pintime[NUM_RELAY + 1];
+
+char pinnames[NUM_RELAY + 1][8];
+
+// bit n set if valve n is open
+static uint32_t openValves = 0;
+
+// bumped on every relay state change, see relayStatus()
+static uint32_t statusVersion = 1;
+
+// uptime relay was last switched on or off, 0 if never switched;
+// used for water usage accounting and minimum dwell times
+static uint64_t switchedAt[NUM_RELAY + 1];
+
+// manual relay command waiting for coalescing window or dwell time
+typedef struct {
+    uint64_t due;
+    bool pending;
+    bool on;
+} relaycmd_t;
+
+static relaycmd_t relayCmds[NUM_RELAY + 1];
+
+// uptime pump is stopped if no valve took over, see setRelay()
+static uint64_t pumpStopAt = 0;
+
+// uptime until pump stays locked out after a current fault, 0 if none
+static uint64_t pumpFaultUntil = 0;
+static uint32_t cmdsCoalesced = 0, cmdsDeferred = 0;
+
+// relay transitions waiting to be written to serial, log and mqtt;
+// single producer (setRelay) and single consumer (logRelayEvents)
+static relaylog_t relayLog[RELAY_LOG_SIZE];
+static std::atomic<uint8_t> relayLogHead(0), relayLogTail(0);
+static std::atomic<uint16_t> relayLogDropped(0);
+
+// relay changes logged but not yet published via mqtt
+static bool publishPending = false;
+
+// valve state transitions, row is current state and column the event
+static const relaystate_t valveTransitions[RELAY_STATES][RELAY_EVENTS] = {
+    //              OPEN           CLOSE          BLOCK          UNBLOCK        LOCKOUT       RELEASE
+    /* OFF */     { RELAY_ON,      RELAY_OFF,     RELAY_BLOCKED, RELAY_OFF,     RELAY_LOCKED, RELAY_OFF },
+    /* ON */      { RELAY_ON,      RELAY_BLOCKED, RELAY_ON,      RELAY_ON,      RELAY_LOCKED, RELAY_ON },
+    /* BLOCKED */ { RELAY_BLOCKED, RELAY_BLOCKED, RELAY_BLOCKED, RELAY_OFF,     RELAY_LOCKED, RELAY_BLOCKED },
+    /* LOCKED */  { RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED, RELAY_BLOCKED }
 };
 
+// the pump is never blocked, only locked out
+static const relaystate_t pumpTransitions[RELAY_STATES][RELAY_EVENTS] = {
+    //              OPEN           CLOSE          BLOCK          UNBLOCK        LOCKOUT       RELEASE
+    /* OFF */     { RELAY_ON,      RELAY_OFF,     RELAY_OFF,     RELAY_OFF,     RELAY_LOCKED, RELAY_OFF },
+    /* ON */      { RELAY_ON,      RELAY_OFF,     RELAY_ON,      RELAY_ON,      RELAY_LOCKED, RELAY_ON },
+    /* BLOCKED */ { RELAY_ON,      RELAY_OFF,     RELAY_OFF,     RELAY_OFF,     RELAY_LOCKED, RELAY_OFF },
+    /* LOCKED */  { RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED,  RELAY_LOCKED, RELAY_OFF }
+};
+
+
+// switch pump and all valves at once according to their current
+// state with a single output write; valves are active low, pump active high
+void relayOutputs() {
+    uint64_t set = 0, clear = 0;
+
+    if (relaystate[0] == RELAY_ON)
+        set |= (1ULL << switchesPrefs.pinPump);
+    else
+        clear |= (1ULL << switchesPrefs.pinPump);
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (switchesPrefs.pinRelay[i-1] < 0)
+            continue;
+        if (relaystate[i] == RELAY_ON)
+            clear |= (1ULL << switchesPrefs.pinRelay[i-1]);
+        else
+            set |= (1ULL << switchesPrefs.pinRelay[i-1]);
+    }
+    hal.pinsWrite(set, clear);
+    sensorsActivity(relaystate[0] == RELAY_ON || openValves);
+#ifdef DEBUG_INTERLOCKS
+    checkInterlocks();
+#endif
+}
+
 
 // define pins configure as relay control port as
 // output set them high since relay are active low
 void initRelays() {
-    pinMode(switchesPrefs.pinPump, OUTPUT);
-    digitalWrite(switchesPrefs.pinPump, 0); // active high
-    for (uint8_t i = 0; i <= 4; i++) {
-        pinMode(switchesPrefs.pinRelay[i-1], OUTPUT);
-        digitalWrite(switchesPrefs.pinRelay[i-1], 1);
+    hal.pinMode(switchesPrefs.pinPump, OUTPUT);
+    strcpy(pinnames[0], "pump");
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        sprintf(pinnames[i], "valve%d", i);
+        if (switchesPrefs.pinRelay[i-1] >= 0)
+            hal.pinMode(switchesPrefs.pinRelay[i-1], OUTPUT);
+    }
+    relayOutputs();  // all relays off
+}
+
+
+// flow demand of valve (l/min), a valve without a declared
+// flow demand takes the full pump capacity
+uint16_t valveFlow(uint8_t num) {
+    if (!num || num > NUM_RELAY || !switchesPrefs.flowRelay[num-1])
+        return switchesPrefs.pumpCapacity;
+    return switchesPrefs.flowRelay[num-1];
+}
+
+
+// check if valve may be opened along with valves already open; without
+// pump capacity set only one valve is open at a time (serial irrigation)
+bool valveFits(uint8_t num) {
+    uint32_t flow = valveFlow(num);
+
+    if (!openValves)
+        return true;
+    if (!switchesPrefs.pumpCapacity)
+        return false;
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (openValves & (1UL << i))
+            flow += valveFlow(i);
+    }
+    return flow <= switchesPrefs.pumpCapacity;
+}
+
+
+// apply event to relay state machine, returns false if event didn't
+// change the relay state; outputs are switched by relayOutputs()
+// all interlocks between pump and valves are checked here
+bool relayEvent(uint8_t num, relayevent_t event) {
+    relaystate_t prev, next;
+
+    if (num > NUM_RELAY || event >= RELAY_EVENTS)
+        return false;
+
+    prev = relaystate[num];
+    next = num ? valveTransitions[prev][event] : pumpTransitions[prev][event];
+
+    // open valves must not exceed pump capacity to keep up pressure,
+    // no valve is opened while pump is locked out
+    if (num > 0 && next == RELAY_ON && prev != RELAY_ON &&
+            (!valveFits(num) || relaystate[0] == RELAY_LOCKED))
+        return false;
+    if (next == prev)
+        return false;
+
+    relaystate[num] = next;
+    statusVersion++;
+    if (next == RELAY_ON) {
+        if (num > 0)
+            openValves |= (1UL << num);
+        if (!num || relaystate[0] == RELAY_ON)
+            pintime[0] = getLocalTime();  // pump auto-stop counts from latest valve
+        switchedAt[num] = getUptimeMillis();
+    } else if (prev == RELAY_ON) {
+        if (num > 0) {
+            openValves &= ~(1UL << num);
+            pintime[num] = getLocalTime(); // remember open valve time
+            usageAdd(num, getUptimeMillis() - switchedAt[num]);
+        }
+        switchedAt[num] = getUptimeMillis();
     }
+    return true;
 }
 
 
 // check if any relay can be unblocked
 void unblockRelays() {
-    uint32_t blockTimeSecs;
-
-    // don't unblock relay if pump currently blocked (e.g. due to low water level)
-    if ((pinstate & pinmap[0][2]) != 0)
+    // don't unblock relay if pump currently locked out (e.g. due to low water level)
+    // or if one valve is currently open
+    if (relaystate[0] == RELAY_LOCKED || openValves)
         return;
 
-    // don't unblock other relay if one valve is currently open
-    for (uint8_t i = 1; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++) {
-        if ((pinstate & pinmap[i][1]) != 0)
-            return;
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (relaystate[i] == RELAY_BLOCKED && 
+                (getLocalTime() - pintime[i]) > (switchesPrefs.relaysBlockMins * 60))
+            relayEvent(i, RELAY_UNBLOCK);
     }
+}
 
-    for (uint8_t i = 1; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++) {
-        blockTimeSecs = getLocalTime() - pintime[i];
-        if ((pinstate & pinmap[i][2]) != 0 && blockTimeSecs > (switchesPrefs.relaysBlockMins * 60)) {
-            pinstate &= ~pinmap[i][2];
-        }
-    } 
+
+// queue relay transition for logRelayEvents(), drops
+// event if queue is full to never stall relay switching
+static void queueRelayEvent(uint8_t num, uint8_t type) {
+    uint8_t head = relayLogHead.load(std::memory_order_relaxed);
+    uint8_t next = (head + 1) & (RELAY_LOG_SIZE - 1);
+
+    if (next == relayLogTail.load(std::memory_order_acquire)) {
+        relayLogDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    relayLog[head].millis = millis();
+    relayLog[head].waterLevel = sensorSnapshot().waterLevel;
+    relayLog[head].relay = num;
+    relayLog[head].type = type;
+    relayLogHead.store(next, std::memory_order_release);
 }
 
 
@@ -89,73 +241,286 @@ void unblockRelays() {
 // blocking relay for certain time after last 
 // being turned on and switching pump on/off 
 void setRelay(uint8_t num, bool on) {
-    bool valveOpen = false;
-    char logmsg[32];
+    bool valve = false, pump = false;
+
+    if (num > NUM_RELAY)
+        return;
 
     if (num != 0) { // valves only
-        if (on) {
-            if ((pinstate & pinmap[num][2]) == 0) {
-                if ((pinstate & pinmap[num][1]) == 0) {
-                    digitalWrite(pinmap[num][0], 0); // active low
-                    pinstate |= pinmap[num][1];
-                    pinstate &= ~pinmap[num][2];
-                    Serial.print(millis());
-                    Serial.printf(": Opened %s\n", pinnames[num]);
-                    sprintf(logmsg, "%s on", pinnames[num]);
-                    logMsg(logmsg);
-
-                    // block other relay if one is open to keep up pressure
-                    for (uint8_t i = 1; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++) {
-                        if (i != num)
-                            pinstate |= pinmap[i][2];
-                    }
-                }
-            } else {
-                Serial.print(millis());
-                Serial.printf(": Relay %s blocked!\n", pinnames[num]);
-                return;
-            }
-        } else {
-            if ((pinstate & pinmap[num][1]) != 0) {
-                digitalWrite(pinmap[num][0], 1);
-                pintime[num] = getLocalTime(); // remember open valve time
-                pinstate &= ~pinmap[num][1];
-                pinstate |= pinmap[num][2]; // blocks this relay for a while
-                Serial.print(millis());
-                Serial.printf(": Closed %s\n", pinnames[num]);
-                sprintf(logmsg, "%s off", pinnames[num]);
-                logMsg(logmsg);
-            }
+        valve = relayEvent(num, on ? RELAY_OPEN : RELAY_CLOSE);
+        if (on && !valve && relaystate[num] != RELAY_ON) {
+            queueRelayEvent(num, RELAY_LOG_BLOCKED);
+            return;
         }
     }
 
-    // turn on pump if at least one valve is open
-    for (uint8_t i = 1; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++) {
-        if ((pinstate & pinmap[i][1]) != 0)
-            valveOpen = true;
+    // turn on pump if at least one valve is open; if another valve opens
+    // within PUMP_HANDOVER_SECS the pump keeps running after the last valve
+    // closed, so the next zone takes over without a pump restart
+    if (openValves || (!num && on)) {
+        pumpStopAt = 0;
+        pump = relayEvent(0, RELAY_OPEN);
+    } else if (num && PUMP_HANDOVER_SECS > 0 && relaystate[0] == RELAY_ON && 
+            jobs_due(getUptimeMillis() + PUMP_HANDOVER_SECS * 1000ULL, true)) {
+        if (!pumpStopAt)
+            pumpStopAt = getUptimeMillis() + PUMP_HANDOVER_SECS * 1000ULL;
+    } else {
+        pumpStopAt = 0;
+        pump = relayEvent(0, RELAY_CLOSE);
     }
 
-    // switch pump
-    if (valveOpen || (!num && on)) {   
-        if ((pinstate & pinmap[0][1]) == 0) {
-            pintime[0] = getLocalTime(); 
-            digitalWrite(switchesPrefs.pinPump, 1);
-            pinstate |= pinmap[0][1];
+    // switch valve and pump simultaneously
+    if (valve || pump)
+        relayOutputs();
+
+    if (valve) {
+        journalUpdate();
+        queueRelayEvent(num, on ? RELAY_LOG_ON : RELAY_LOG_OFF);
+    }
+    if (pump)
+        queueRelayEvent(0, relaystate[0] == RELAY_ON ? RELAY_LOG_ON : RELAY_LOG_OFF);
+}
+
+
+// earliest uptime a valve may be switched to given state so that
+// valve and pump stay on/off for at least RELAY_MIN_ON/OFF_MS
+static uint64_t dwellUntil(uint8_t num, bool on) {
+    uint64_t until = 0;
+    bool isOn = (relaystate[num] == RELAY_ON);
+
+    if (on != isOn && switchedAt[num])
+        until = switchedAt[num] + (isOn ? RELAY_MIN_ON_MS : RELAY_MIN_OFF_MS);
+
+    // opening a valve starts the pump, closing the last open valve stops it
+    if (on && relaystate[0] != RELAY_ON && switchedAt[0])
+        until = max(until, switchedAt[0] + RELAY_MIN_OFF_MS);
+    else if (!on && isOn && openValves == (1UL << num) && relaystate[0] == RELAY_ON)
+        until = max(until, switchedAt[0] + RELAY_MIN_ON_MS);
+    return until;
+}
+
+
+// queue manual command (web ui, mqtt) for a valve; it is carried out 
+// after RELAY_COMMAND_WINDOW_MS so that an opposing command within this 
+// window cancels it, relay commands by the scheduler bypass this queue
+void requestRelay(uint8_t num, bool on) {
+    relaycmd_t* cmd;
+
+    if (num == 0 || num > NUM_RELAY)
+        return;
+    cmd = &relayCmds[num];
+
+    if (cmd->pending) {
+        cmdsCoalesced++;
+        if (cmd->on != on) {
+            cmd->pending = false;  // toggled back, nothing to do
+            statusVersion++;
             Serial.print(millis());
-            Serial.println(F(": Pump on"));
-            sprintf(logmsg, "pump on, water %dcm", sensors.waterLevel);
-            logMsg(logmsg);
+            Serial.printf(": Commands for %s cancelled out\n", pinnames[num]);
         }
-    } else if (!valveOpen || (!num && !on)) {
-        if ((pinstate & pinmap[0][1]) != 0) {
-            digitalWrite(switchesPrefs.pinPump, 0);
-            pinstate &= ~pinmap[0][1];
+        return;
+    }
+    if (on == (relaystate[num] == RELAY_ON)) {
+        cmdsCoalesced++;  // no change
+        return;
+    }
+    cmd->pending = true;
+    cmd->on = on;
+    cmd->due = getUptimeMillis() + RELAY_COMMAND_WINDOW_MS;
+    statusVersion++;  // reported as commanded by relayStatus()
+}
+
+
+// carry out queued relay commands which are due and have met
+// their dwell time, stop pump after handover; a command carried
+// out cancels pending programs, one cancelled out within its
+// window leaves them alone; called from main loop
+void relayCommands() {
+    uint64_t now = getUptimeMillis(), until;
+
+    // no zone took over the running pump
+    if (pumpStopAt && now >= pumpStopAt && !openValves)
+        setRelay(0, false);
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (!relayCmds[i].pending || now < relayCmds[i].due)
+            continue;
+        until = dwellUntil(i, relayCmds[i].on);
+        if (now < until) {
+            relayCmds[i].due = until;
+            cmdsDeferred++;
             Serial.print(millis());
-            Serial.println(F(": Pump off"));
-            sprintf(logmsg, "pump off, water %dcm", sensors.waterLevel);
-            logMsg(logmsg);
+            Serial.printf(": %s deferred for %lu ms (dwell time)\n", pinnames[i], (unsigned long)(until - now));
+            continue;
+        }
+        relayCmds[i].pending = false;
+        statusVersion++;  // also if valve turns out blocked
+        preempt_jobs(JOB_MANUAL, openValves);  // manual override
+        setRelay(i, relayCmds[i].on);
+    }
+}
+
+
+// number of manual relay commands coalesced (dropped)
+// and deferred due to minimum dwell time since boot
+void relayCommandStats(uint32_t* coalesced, uint32_t* deferred) {
+    *coalesced = cmdsCoalesced;
+    *deferred = cmdsDeferred;
+}
+
+
+// close all valves and turn off pump with a single output write
+static void relaysOff() {
+    uint32_t closed = 0;
+    bool pump;
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (relayEvent(i, RELAY_CLOSE))
+            closed |= (1UL << i);
+    }
+    pump = relayEvent(0, RELAY_CLOSE);
+    pumpStopAt = 0;
+    memset(relayCmds, 0, sizeof(relayCmds));  // drop pending manual commands
+    statusVersion++;
+    if (!pump && !closed)
+        return;
+    relayOutputs();
+
+    if (closed)
+        journalUpdate();
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (closed & (1UL << i))
+            queueRelayEvent(i, RELAY_LOG_OFF);
+    }
+    if (pump)
+        queueRelayEvent(0, RELAY_LOG_OFF);
+}
+
+
+// write queued relay transitions to serial and log file
+// and publish new relay state; called from main loop
+void logRelayEvents() {
+    uint8_t tail = relayLogTail.load(std::memory_order_relaxed);
+    uint16_t dropped;
+    relaylog_t ev;
+    bool changed = false;
+    char logmsg[32];
+
+    while (tail != relayLogHead.load(std::memory_order_acquire)) {
+        ev = relayLog[tail];
+        tail = (tail + 1) & (RELAY_LOG_SIZE - 1);
+        relayLogTail.store(tail, std::memory_order_release);
+
+        Serial.print(ev.millis);
+        if (ev.type == RELAY_LOG_BLOCKED) {
+            Serial.printf(": Relay %s blocked!\n", pinnames[ev.relay]);
+            continue;
+        }
+        changed = true;
+        if (ev.relay) {
+            Serial.printf(": %s %s\n", ev.type == RELAY_LOG_ON ? "Opened" : "Closed", pinnames[ev.relay]);
+            sprintf(logmsg, "%s %s", pinnames[ev.relay], ev.type == RELAY_LOG_ON ? "on" : "off");
+        } else {
+            Serial.printf(": Pump %s\n", ev.type == RELAY_LOG_ON ? "on" : "off");
+            sprintf(logmsg, "pump %s, water %dcm", ev.type == RELAY_LOG_ON ? "on" : "off", ev.waterLevel);
         }
+        logMsg(logmsg);
+    }
+
+    dropped = relayLogDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        Serial.print(millis());
+        Serial.printf(": WARNING: %d relay events not logged\n", dropped);
+        sprintf(logmsg, "%d relay events lost", dropped);
+        logMsg(logmsg);
     }
+
+    // changed relay settings are published by main loop
+    if (changed)
+        publishPending = true;
+}
+
+
+// returns true once after relays have changed, so that main loop
+// publishes the new state without waiting for the push interval
+bool relayPublishDue() {
+    bool due = publishPending;
+
+    publishPending = false;
+    return due;
+}
+
+
+// publish of changed relays failed, retried on next call of main loop
+void relayPublishRetry() {
+    publishPending = true;
+}
+
+
+// turn off pump and close all valves, then lock out all relays;
+// shared by low water level and pump current faults
+static void lockoutRelays() {
+    bool pumpon = (relaystate[0] == RELAY_ON);
+
+    preempt_jobs(JOB_SAFETY, 0);
+    relaysOff();
+    for (uint8_t i = 0; i <= NUM_RELAY; i++)
+        relayEvent(i, RELAY_LOCKOUT);
+    relayOutputs();
+    if (pumpon)
+        reportMoisture(true, true);
+}
+
+
+// sample pump current while pump is running and lock out pump 
+// and valves on dry run, clogged line or stalled pump for
+// PUMP_FAULT_LOCKOUT_MINS; not during pump handover between 
+// zones; called from main loop
+void pumpMonitor() {
+#ifdef PUMP_CURRENT_PIN
+    static const currentLimits_t limits = {
+        PUMP_CURRENT_DRY_MA,
+        PUMP_CURRENT_CLOG_MA,
+        PUMP_CURRENT_STALL_MA,
+        PUMP_CURRENT_NONE_MA,
+        PUMP_CURRENT_STARTUP_MS,
+        PUMP_CURRENT_FAULT_MS,
+        PUMP_CURRENT_STALL_MS
+    };
+    static currentDetector_t detector;
+    static uint64_t lastSample = 0;
+    static bool running = false;
+    uint64_t now = getUptimeMillis();
+    currentfault_t fault;
+    char logmsg[48];
+
+    // pump runs against closed valves during zone handover (dead-heading),
+    // detection restarts with start-up grace once the next valve opens
+    if (relaystate[0] != RELAY_ON || (pumpStopAt && !openValves)) {
+        running = false;
+        return;
+    }
+    if (!running) {
+        currentReset(&detector, &limits);
+        lastSample = now;
+        running = true;
+    } else if ((now - lastSample) < PUMP_CURRENT_SAMPLE_MS) {
+        return;
+    }
+
+    fault = currentDetect(&detector, sensorSnapshot().pumpCurrent, now - lastSample);
+    lastSample = now;
+    if (fault == CURRENT_OK)
+        return;
+
+    Serial.print(millis());
+    Serial.printf(": WARNING: Pump %s (%d mA)\n", currentFaultString(fault), currentFiltered(&detector));
+    sprintf(logmsg, "pump %s, %dmA", currentFaultString(fault), currentFiltered(&detector));
+    logMsg(logmsg);
+    pumpFaultUntil = now + PUMP_FAULT_LOCKOUT_MINS * 60000ULL;
+    lockoutRelays();
+    running = false;
+#endif
 }
 
 
@@ -164,45 +529,56 @@ void setRelay(uint8_t num, bool on) {
 // timeout or if water level reaches lower limit
 void pumpAutoStop() {
     static char logmsg[48];
-    bool pumpoff = false;
+    bool pumpoff = false, lockout = false;
+
+    // pump current fault lockout has expired
+    if (pumpFaultUntil && getUptimeMillis() >= pumpFaultUntil) {
+        pumpFaultUntil = 0;
+        Serial.print(millis());
+        Serial.println(F(": Pump fault lockout expired"));
+#if !defined(US_TRIGGER_PIN) || !defined(US_ECHO_PIN)
+        for (uint8_t i = 0; i <= NUM_RELAY; i++)
+            relayEvent(i, RELAY_RELEASE);
+        logMsg("pump unblocked");
+#endif
+    }
 
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-    // update level reading regularly if pump is running
-    if ((pinstate & pinmap[0][1]) != 0)
-        readWaterLevel(false, false);
-
-    // unblock pump if water level is known or deliberately ignored
-    if ((sensors.waterLevel > switchesPrefs.minWaterLevel || 
-            switchesPrefs.ignoreWaterLevel) && (pinstate & pinmap[0][2]) != 0) {
-        pinstate &= ~pinmap[0][2];
+    // level is sampled once per second by sensor task
+    int16_t waterLevel = sensorSnapshot().waterLevel;
+
+    // release pump and valves if water level is known or deliberately ignored
+    if ((waterLevel > switchesPrefs.minWaterLevel || 
+            switchesPrefs.ignoreWaterLevel) && relaystate[0] == RELAY_LOCKED && !pumpFaultUntil) {
+        for (uint8_t i = 0; i <= NUM_RELAY; i++)
+            relayEvent(i, RELAY_RELEASE);
         Serial.print(millis());
         Serial.printf(": Pump unblocked (%swater level %d cm)\n", 
-            switchesPrefs.ignoreWaterLevel ? "ignoring " : "", sensors.waterLevel);
+            switchesPrefs.ignoreWaterLevel ? "ignoring " : "", waterLevel);
         sprintf(logmsg, "pump unblocked, %swater %dcm", 
-            switchesPrefs.ignoreWaterLevel ? "ignoring " : "", sensors.waterLevel);
+            switchesPrefs.ignoreWaterLevel ? "ignoring " : "", waterLevel);
         logMsg(logmsg);
 
-    // turn off and block pump and valves if water level is unknown due to sensor error
-    } else if (sensors.waterLevel <= switchesPrefs.minWaterLevel &&
-            !switchesPrefs.ignoreWaterLevel && (pinstate & pinmap[0][2]) == 0) {
+    // turn off and lock out pump and valves if water level is unknown due to sensor error
+    } else if (waterLevel <= switchesPrefs.minWaterLevel &&
+            !switchesPrefs.ignoreWaterLevel && relaystate[0] != RELAY_LOCKED) {
         Serial.print(millis());
-        if (sensors.waterLevel <= 0) {
+        if (waterLevel <= 0) {
             Serial.println(F(": WARNING: System blocked (unknown water level)"));
             logMsg("system blocked, unknown water level");
         } else {
-            Serial.printf(": WARNING: Low water level %d cm\n", sensors.waterLevel);
-            sprintf(logmsg, "low water, %dcm", sensors.waterLevel);
+            Serial.printf(": WARNING: Low water level %d cm\n", waterLevel);
+            sprintf(logmsg, "low water, %dcm", waterLevel);
             logMsg(logmsg);
         }
         pumpoff = true;
-        for (uint8_t i = 0; i < (sizeof(pinmap) / sizeof(pinmap[0])); i++)
-            pinstate |= pinmap[i][2]; // block all relay
+        lockout = true;
     }
 #endif
 
     // turn off pump if auto-stop time has been reached 
     // time limit is checked to avoid accidental overwatering
-    if (pinstate & pinmap[0][1] != 0) {
+    if (relaystate[0] == RELAY_ON) {
         if ((getLocalTime() - pintime[0]) > switchesPrefs.pumpAutoStopSecs) {
             pumpoff = true;
             Serial.print(millis());
@@ -211,29 +587,121 @@ void pumpAutoStop() {
             logMsg(logmsg);
         }
 
-        // block all valves and then turn off pump
-        if (pumpoff) {
-            for (int8_t i = ((sizeof(pinmap) / sizeof(pinmap[0])) - 1); i >= 0; i--)
-                setRelay(i, false);
-            readMoisture(true, true, false);
-            mqtt_send(MQTT_TIMEOUT_MS);
+        // drop all queued valve jobs, close all valves and then turn off pump
+        if (pumpoff && !lockout) {
+            preempt_jobs(JOB_SAFETY, 0);
+            relaysOff();
+            reportMoisture(true, true);
         }
     }
+
+    // lock out all relays until water level is back to normal
+    if (lockout)
+        lockoutRelays();
 }
 
 
-// return current relay/pump status as json string
-uint16_t relayStatus(char *buf, size_t s) {
-    static StaticJsonDocument<128> JSON;
-    for (uint8_t i = 0; i < (sizeof(pinmap)/sizeof(pinmap[0])); i++) {
-        if (i > 0 && switchesPrefs.pinRelay[i-1] < 0)
-            JSON[pinnames[i]] = -1;  // disabled
-        else if ((pinstate & pinmap[i][2]) != 0)
-            JSON[pinnames[i]] = 2;  // blocked
-        else if ((pinstate & pinmap[i][1]) != 0)
-            JSON[pinnames[i]] = 1;  // on
-        else
-            JSON[pinnames[i]] = 0;  // off
+// verify relay interlocks, returns false and reports each violated
+// invariant; run after every output change and once per second if 
+// DEBUG_INTERLOCKS is set, may also serve as oracle for randomized 
+// command/sensor/time sequences driven through this module
+bool checkInterlocks() {
+    uint32_t open = 0, flow = 0;
+    bool ok = true;
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (relaystate[i] == RELAY_ON) {
+            open |= (1UL << i);
+            flow += valveFlow(i);
+        }
+    }
+
+    // bookkeeping of open valves matches their state
+    if (open != openValves) {
+        Serial.printf("Interlock: open valves 0x%lx, expected 0x%lx\n", (unsigned long)openValves, (unsigned long)open);
+        ok = false;
+    }
+
+    // one valve at a time or within pump capacity to keep up pressure
+    if ((!switchesPrefs.pumpCapacity && (open & (open - 1))) ||
+            (switchesPrefs.pumpCapacity && (open & (open - 1)) && flow > switchesPrefs.pumpCapacity)) {
+        Serial.printf("Interlock: valves 0x%lx open, %lu l/min exceeds pump\n", (unsigned long)open, (unsigned long)flow);
+        ok = false;
+    }
+
+    // an open valve needs the pump running, a locked out pump no open valves
+    if (open && relaystate[0] != RELAY_ON) {
+        Serial.printf("Interlock: valves 0x%lx open with pump %s\n", (unsigned long)open,
+            relaystate[0] == RELAY_LOCKED ? "locked out" : "off");
+        ok = false;
+    }
+
+    // closed valves stay blocked for relaysBlockMins
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (relaystate[i] == RELAY_OFF && pintime[i] && 
+                (getLocalTime() - pintime[i]) <= (switchesPrefs.relaysBlockMins * 60)) {
+            Serial.printf("Interlock: %s unblocked early\n", pinnames[i]);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+// returns bitmask of open valves (bit n for relay n)
+uint32_t relaysOpen() {
+    return openValves;
+}
+
+
+// relay/pump status as reported to clients,
+// -1 disabled, 0 off, 1 on, 2 blocked
+int8_t relayStatusCode(uint8_t num) {
+    if (num > NUM_RELAY || (num > 0 && switchesPrefs.pinRelay[num-1] < 0))
+        return -1;
+    if (relaystate[num] == RELAY_BLOCKED || relaystate[num] == RELAY_LOCKED ||
+            (num > 0 && relaystate[num] == RELAY_OFF && !valveFits(num)))
+        return 2;
+    return (relaystate[num] == RELAY_ON) ? 1 : 0;
+}
+
+
+// version of relay status, changes whenever a relay
+// changes its state or relay settings are modified
+uint32_t relayVersion() {
+    return statusVersion;
+}
+
+
+// mark relay status as changed, e.g. after pin settings were saved
+void relayStatusChanged() {
+    statusVersion++;
+}
+
+
+// return current relay/pump status as json string, serialized 
+// only if status has changed since it was last requested; valves
+// with a pending manual command are reported in commanded state, 
+// so web ui switches don't snap back until it is carried out
+const char* relayStatus(uint16_t* len) {
+    static StaticJsonDocument<JSON_OBJECT_SIZE(NUM_RELAY + 1) + (NUM_RELAY + 1) * 8> JSON;
+    static char status[RELAY_STATUS_SIZE];
+    static uint16_t statusLen = 0;
+    static uint32_t version = 0;
+    int8_t code;
+
+    if (version != statusVersion) {
+        JSON.clear();
+        for (uint8_t i = 0; i <= NUM_RELAY; i++) {
+            code = relayStatusCode(i);
+            if (i > 0 && code >= 0 && relayCmds[i].pending)
+                code = relayCmds[i].on ? 1 : 0;
+            JSON[pinnames[i]] = code;
+        }
+        statusLen = serializeJson(JSON, status, sizeof(status));
+        version = statusVersion;
     }
-    return serializeJson(JSON, buf, s); 
+    if (len)
+        *len = statusLen;
+    return status;
 }
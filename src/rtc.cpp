@@ -21,6 +21,7 @@
 #include "config.h"
 #include "rtc.h"
 #include "logging.h"
+#include "hal.h"
 
 RTC_DATA_ATTR uint32_t busyTime = 0;
 
@@ -76,9 +77,33 @@ char* getRuntime(uint32_t runtimeSecs) {
 
 // returns local time (seconds since epoch)
 time_t getLocalTime() {
-    time_t time_utc;
-    time(&time_utc);
-    return TZ.toLocal(time_utc);
+    return TZ.toLocal(hal.utcTime());
+}
+
+
+// returns system time (UTC, seconds since epoch)
+time_t getUTCTime() {
+    return hal.utcTime();
+}
+
+
+// converts local time (seconds since epoch) to UTC
+time_t localToUTC(time_t local) {
+    return TZ.toUTC(local);
+}
+
+
+// converts UTC (seconds since epoch) to local time
+time_t utcToLocal(time_t utc) {
+    return TZ.toLocal(utc);
+}
+
+
+// returns milliseconds since boot on a 64-bit monotonic clock
+// unlike millis() it doesn't wrap after ~49 days and isn't
+// affected by NTP adjustments of the system time
+uint64_t getUptimeMillis() {
+    return hal.uptimeMillis();
 }
 
 
@@ -133,7 +158,7 @@ char* getTimeZone() {
     TimeChangeRule *tcr; 
     time_t now;
 
-    time(&now);
+    now = getUTCTime();
     TZ.toLocal(now, &tcr);
     strncpy(tz, tcr->abbrev, 5);
     return tz;
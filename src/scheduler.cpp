@@ -19,45 +19,529 @@
 ***************************************************************************/
 
 #include "scheduler.h"
+#include "rtc.h"
+#include "logging.h"
+#include "journal.h"
 
-valvejob_t* scheduledjobs = NULL;
-valvejob_t valvejobs[MAX_JOBS];
+schedulerStats_t schedulerStats = { 0, UINT32_MAX, 0, 0, { 0 } };
 
-// schedule a valve job
-void schedule_job(valvejob_t* job, time_t time, jobfn_t func, uint8_t relay, bool state) {
-    valvejob_t** pnext;
+// pool of jobs, free slots are kept on a stack
+static valvejob_t valvejobs[MAX_JOBS];
+static uint16_t freejobs[MAX_JOBS];
+static uint16_t numfree = 0;
+static bool poolInited = false;
+static uint16_t numjobs = 0;  // jobs in queue including stale ones
+static uint32_t jobseq = 0;
 
-    if (time <= 0)
-        time = 1;
+// preempting a class increments its epoch, which turns all queued jobs
+// of that class stale in O(1); stale jobs are dropped when they become
+// due or if the pool runs out of free slots
+static uint32_t classEpoch[JOB_PRIORITIES];
+static uint16_t classJobs[JOB_PRIORITIES];  // live jobs per class
 
-    // create job...
-    job->next = NULL;
-    job->time = time;
-    job->func = func;
-    job->relay = relay;
-    job->state = state;
 
-    // ...and insert it into schedule
-    for (pnext = &scheduledjobs; *pnext; pnext = &((*pnext)->next)) {
-        if (((*pnext)->time - time) > 0) {
-            job->next = *pnext;
+// true if job in slot a is due before job in slot b
+static bool job_before(uint16_t a, uint16_t b) {
+    if (valvejobs[a].time != valvejobs[b].time)
+        return valvejobs[a].time < valvejobs[b].time;
+    return (int32_t)(valvejobs[a].seq - valvejobs[b].seq) < 0;
+}
+
+#ifndef SCHEDULER_TIMING_WHEEL
+
+// binary min-heap of pool slots ordered by deadline, root is the next job due
+static uint16_t jobqueue[MAX_JOBS];
+
+
+// put job into heap at given position
+static void place_job(uint16_t slot, uint16_t pos) {
+    jobqueue[pos] = slot;
+    valvejobs[slot].pos = pos;
+}
+
+
+// move job at given heap position up towards the root
+static void sift_up(uint16_t pos) {
+    uint16_t slot = jobqueue[pos];
+
+    while (pos > 0) {
+        uint16_t parent = (pos - 1) / 2;
+        if (!job_before(slot, jobqueue[parent]))
             break;
+        place_job(jobqueue[parent], pos);
+        pos = parent;
+    }
+    place_job(slot, pos);
+}
+
+
+// move job at given heap position down towards the leaves
+static void sift_down(uint16_t pos) {
+    uint16_t slot = jobqueue[pos];
+    uint16_t child;
+
+    while ((child = 2 * pos + 1) < numjobs) {
+        if ((child + 1) < numjobs && job_before(jobqueue[child+1], jobqueue[child]))
+            child++;
+        if (!job_before(jobqueue[child], slot))
+            break;
+        place_job(jobqueue[child], pos);
+        pos = child;
+    }
+    place_job(slot, pos);
+}
+
+
+// add job to queue, O(log n)
+static void queue_insert(uint16_t slot) {
+    place_job(slot, numjobs);
+    sift_up(numjobs++);
+}
+
+
+// remove job from queue, O(log n)
+static void queue_remove(uint16_t slot) {
+    uint16_t pos = valvejobs[slot].pos;
+
+    if (--numjobs == pos)
+        return;
+    place_job(jobqueue[numjobs], pos);
+    if (pos > 0 && job_before(jobqueue[pos], jobqueue[(pos - 1) / 2]))
+        sift_up(pos);
+    else
+        sift_down(pos);
+}
+
+
+// returns next job due at given time or JOB_FREE
+static uint16_t queue_next_due(uint64_t now) {
+    if (numjobs > 0 && valvejobs[jobqueue[0]].time <= now)
+        return jobqueue[0];
+    return JOB_FREE;
+}
+
+#else
+
+// hierarchical timing wheel, level n slots span 64^n ticks; jobs in
+// higher levels are cascaded down when the wheel reaches their slot
+static uint16_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t wheelUsed[WHEEL_LEVELS];  // bit per slot holding jobs
+static uint64_t wheelTick = 0;  // all ticks before have been processed
+static uint64_t wheelNext = 0;  // no slot holding jobs is reached before
+
+
+// add job to wheel slot according to its distance from current tick, O(1)
+static void queue_insert(uint16_t slot) {
+    uint64_t tick = valvejobs[slot].time / WHEEL_TICK_MS;
+    uint64_t delta;
+    uint16_t* head;
+    uint8_t level = 0;
+
+    if (tick < wheelTick)
+        tick = wheelTick;  // overdue, handle with current tick
+    delta = tick - wheelTick;
+    if (delta >= (1ULL << (6 * WHEEL_LEVELS))) {
+        delta = (1ULL << (6 * WHEEL_LEVELS)) - 1;  // re-inserted on cascade
+        tick = wheelTick + delta;
+    }
+    while (level < (WHEEL_LEVELS - 1) && delta >= (1ULL << (6 * (level + 1))))
+        level++;
+
+    valvejobs[slot].pos = level * WHEEL_SLOTS + ((tick >> (6 * level)) & (WHEEL_SLOTS - 1));
+    head = &wheel[level][(tick >> (6 * level)) & (WHEEL_SLOTS - 1)];
+    valvejobs[slot].prev = JOB_FREE;
+    valvejobs[slot].next = *head;
+    if (*head != JOB_FREE)
+        valvejobs[*head].prev = slot;
+    *head = slot;
+    wheelUsed[level] |= 1ULL << (valvejobs[slot].pos % WHEEL_SLOTS);
+    wheelNext = min(wheelNext, (tick >> (6 * level)) << (6 * level));
+    numjobs++;
+}
+
+
+// unlink job from its wheel slot, O(1)
+static void queue_remove(uint16_t slot) {
+    valvejob_t* job = &valvejobs[slot];
+
+    if (job->prev != JOB_FREE)
+        valvejobs[job->prev].next = job->next;
+    else if ((wheel[job->pos / WHEEL_SLOTS][job->pos % WHEEL_SLOTS] = job->next) == JOB_FREE)
+        wheelUsed[job->pos / WHEEL_SLOTS] &= ~(1ULL << (job->pos % WHEEL_SLOTS));
+    if (job->next != JOB_FREE)
+        valvejobs[job->next].prev = job->prev;
+    numjobs--;
+}
+
+
+// move jobs from slot of given level down to lower levels
+static void cascade(uint8_t level) {
+    uint16_t slot, next;
+
+    slot = wheel[level][(wheelTick >> (6 * level)) & (WHEEL_SLOTS - 1)];
+    wheel[level][(wheelTick >> (6 * level)) & (WHEEL_SLOTS - 1)] = JOB_FREE;
+    wheelUsed[level] &= ~(1ULL << ((wheelTick >> (6 * level)) & (WHEEL_SLOTS - 1)));
+    while (slot != JOB_FREE) {
+        next = valvejobs[slot].next;
+        numjobs--;
+        queue_insert(slot);
+        slot = next;
+    }
+}
+
+
+// first tick after the current one which reaches a slot holding jobs
+// on any level; ticks in between are empty and can be skipped, their
+// cascades would move no jobs
+static uint64_t wheel_next_tick() {
+    uint64_t used, tick, next = UINT64_MAX;
+    uint8_t from;
+
+    for (uint8_t level = 0; level < WHEEL_LEVELS; level++) {
+        // rotate slots following the current one down to bit 0
+        from = ((wheelTick >> (6 * level)) + 1) & (WHEEL_SLOTS - 1);
+        used = wheelUsed[level];
+        if (from)
+            used = (used >> from) | (used << (WHEEL_SLOTS - from));
+        if (!used)
+            continue;
+        tick = ((wheelTick >> (6 * level)) + __builtin_ctzll(used) + 1) << (6 * level);
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+
+// returns next job due at given time or JOB_FREE, advances wheel to
+// given time skipping empty ticks (per level bitmap of used slots),
+// a pass without any slot reached is O(1)
+static uint16_t queue_next_due(uint64_t now) {
+    uint64_t target = now / WHEEL_TICK_MS;
+    uint16_t slot, due;
+
+    if (!numjobs) {
+        if (target > wheelTick)
+            wheelTick = target;
+        return JOB_FREE;
+    }
+
+    // no slot holding jobs reached by then, e.g. most passes of main loop
+    if (wheelTick < target && target < wheelNext && 
+            !(wheelUsed[0] & (1ULL << (wheelTick & (WHEEL_SLOTS - 1))))) {
+        wheelTick = target;
+        return JOB_FREE;
+    }
+
+    while (wheelTick <= target) {
+        // earliest due job in slot of current tick
+        due = JOB_FREE;
+        for (slot = wheel[0][wheelTick & (WHEEL_SLOTS - 1)]; slot != JOB_FREE; slot = valvejobs[slot].next) {
+            if (valvejobs[slot].time <= now && (due == JOB_FREE || job_before(slot, due)))
+                due = slot;
+        }
+        if (due != JOB_FREE || wheelTick == target)
+            return due;
+
+        if (wheelNext <= wheelTick)
+            wheelNext = wheel_next_tick();
+        wheelTick = min(wheelNext, target);
+        for (uint8_t level = 1; level < WHEEL_LEVELS; level++) {
+            if (wheelTick & ((1ULL << (6 * level)) - 1))
+                break;
+            cascade(level);
+        }
+    }
+    return JOB_FREE;
+}
+
+#endif
+
+
+// return slot to pool, invalidates all handles to it
+static void release_job(uint16_t slot) {
+    if (++valvejobs[slot].gen == 0)
+        valvejobs[slot].gen = 1;
+    valvejobs[slot].pos = JOB_FREE;
+    freejobs[numfree++] = slot;
+}
+
+
+// true if job hasn't been preempted
+static bool job_live(uint16_t slot) {
+    return valvejobs[slot].epoch == classEpoch[valvejobs[slot].prio];
+}
+
+
+// remove job from queue and return it to pool
+static void drop_job(uint16_t slot) {
+    if (job_live(slot))
+        classJobs[valvejobs[slot].prio]--;
+    queue_remove(slot);
+    release_job(slot);
+}
+
+
+// free slots of all preempted jobs, O(n)
+static void purge_stale_jobs() {
+    for (uint16_t i = 0; i < MAX_JOBS; i++) {
+        if (valvejobs[i].pos != JOB_FREE && !job_live(i))
+            drop_job(i);
+    }
+}
+
+
+// map handle to pool slot, returns JOB_FREE if handle is outdated
+static uint16_t job_slot(jobhandle_t handle) {
+    uint16_t slot = (handle & 0xFFFF) - 1;
+
+    if (handle == JOB_INVALID || slot >= MAX_JOBS || valvejobs[slot].gen != (handle >> 16))
+        return JOB_FREE;
+    return slot;
+}
+
+
+// schedule a valve job, time is a deadline on the monotonic clock 
+// returned by getUptimeMillis(); returns handle or JOB_INVALID
+jobhandle_t schedule_job(uint64_t time, jobfn_t func, uint8_t relay, bool state, jobprio_t prio) {
+    uint16_t slot;
+
+    if (!poolInited) {
+        for (uint16_t i = 0; i < MAX_JOBS; i++) {
+            valvejobs[i].gen = 1;
+            valvejobs[i].pos = JOB_FREE;
+            freejobs[i] = MAX_JOBS - 1 - i;
         }
+        numfree = MAX_JOBS;
+#ifdef SCHEDULER_TIMING_WHEEL
+        memset(wheel, 0xFF, sizeof(wheel));
+        memset(wheelUsed, 0, sizeof(wheelUsed));
+        wheelTick = getUptimeMillis() / WHEEL_TICK_MS;
+#endif
+        poolInited = true;
+    }
+
+    if (!numfree)
+        purge_stale_jobs();
+    if (!numfree) {
+        Serial.print(millis());
+        Serial.println(F(": Scheduler: job queue full!"));
+        return JOB_INVALID;
     }
-    *pnext = job;
+
+    // create job...
+    slot = freejobs[--numfree];
+    valvejobs[slot].time = time;
+    valvejobs[slot].seq = jobseq++;
+    valvejobs[slot].func = func;
+    valvejobs[slot].relay = relay;
+    valvejobs[slot].state = state;
+    valvejobs[slot].prio = prio;
+    valvejobs[slot].epoch = classEpoch[prio];
+    classJobs[prio]++;
+
+    // ...and insert it into schedule
+    queue_insert(slot);
+    journalUpdate();
+    return ((jobhandle_t)valvejobs[slot].gen << 16) | (slot + 1);
 }
 
 
-// execute scheduled jobs
+// remove pending job from schedule, returns false 
+// if job has already run or has been preempted
+bool cancel_job(jobhandle_t handle) {
+    uint16_t slot = job_slot(handle);
+    bool live;
+
+    if (slot == JOB_FREE)
+        return false;
+    live = job_live(slot);
+    drop_job(slot);
+    journalUpdate();
+    return live;
+}
+
+
+// move pending job to a new deadline
+bool reschedule_job(jobhandle_t handle, uint64_t time) {
+    uint16_t slot = job_slot(handle);
+
+    if (slot == JOB_FREE || !job_live(slot))
+        return false;
+    queue_remove(slot);
+    valvejobs[slot].time = time;
+    valvejobs[slot].seq = jobseq++;
+    queue_insert(slot);
+    journalUpdate();
+    return true;
+}
+
+
+// cancel all jobs with lower priority than given class in O(1),
+// e.g. a manual override drops pending irrigation programs; the
+// next close job of each relay in keepRelays (bit n for relay n)
+// survives, so a valve opened by a preempted program still closes
+// on time, takes O(n) if any relay is kept
+uint16_t preempt_jobs(jobprio_t prio, uint32_t keepRelays) {
+    uint16_t keep[32], cancelled = 0;
+    valvejob_t* job;
+    char logmsg[32];
+
+    for (uint8_t r = 0; r < 32; r++)
+        keep[r] = JOB_FREE;
+    for (uint16_t i = 0; keepRelays && i < MAX_JOBS; i++) {
+        job = &valvejobs[i];
+        if (job->pos == JOB_FREE || job->prio <= prio || job->state || job->relay >= 32 || 
+                !(keepRelays & (1UL << job->relay)) || !job_live(i))
+            continue;
+        if (keep[job->relay] == JOB_FREE || job_before(i, keep[job->relay]))
+            keep[job->relay] = i;
+    }
+
+    for (uint8_t i = prio + 1; i < JOB_PRIORITIES; i++) {
+        cancelled += classJobs[i];
+        classJobs[i] = 0;
+        classEpoch[i]++;
+    }
+    for (uint8_t r = 0; keepRelays && r < 32; r++) {
+        if (keep[r] == JOB_FREE)
+            continue;
+        job = &valvejobs[keep[r]];
+        job->epoch = classEpoch[job->prio];
+        classJobs[job->prio]++;
+        cancelled--;
+    }
+    journalUpdate();
+
+    if (cancelled > 0) {
+        Serial.print(millis());
+        Serial.printf(": Scheduler: %d job(s) preempted\n", cancelled);
+        sprintf(logmsg, "%d jobs preempted", cancelled);
+        logMsg(logmsg);
+    }
+    return cancelled;
+}
+
+
+// add dispatch lateness of a job to statistics
+// bucket 0 counts jobs on time, bucket n those late by [2^(n-1), 2^n) ms
+static void record_lateness(uint32_t lateMillis) {
+    uint8_t bucket = 0;
+
+    while (bucket < (LATENESS_BUCKETS - 1) && (lateMillis >> bucket) > 0)
+        bucket++;
+    schedulerStats.histogram[bucket]++;
+    schedulerStats.jobs++;
+    schedulerStats.sumMillis += lateMillis;
+    if (lateMillis < schedulerStats.minMillis)
+        schedulerStats.minMillis = lateMillis;
+    if (lateMillis > schedulerStats.maxMillis)
+        schedulerStats.maxMillis = lateMillis;
+}
+
+
+// execute all jobs which are due at the start of this pass
 void scheduler() {
-    if (jobs_scheduled() && (scheduledjobs->time < millis())) {
-        scheduledjobs->func(scheduledjobs->relay, scheduledjobs->state);
-        scheduledjobs = scheduledjobs->next;
+    valvejob_t job;
+    uint64_t now = getUptimeMillis();
+    uint64_t dispatched;
+    uint16_t slot;
+
+    while ((slot = queue_next_due(now)) != JOB_FREE) {
+        if (!job_live(slot)) {
+            drop_job(slot);  // preempted
+            continue;
+        }
+        job = valvejobs[slot];  // slot might be reused by job function
+        drop_job(slot);
+        dispatched = getUptimeMillis();
+        record_lateness(dispatched > job.time ? (dispatched - job.time) : 0);
+        journalUpdate();
+        job.func(job.relay, job.state);
+    }
+}
+
+
+// returns upper bound of given lateness percentile in ms
+// derived from histogram, capped by max. observed lateness
+uint32_t scheduler_lateness(uint8_t percentile) {
+    uint64_t threshold, count = 0;
+    uint32_t bound;
+
+    if (!schedulerStats.jobs)
+        return 0;
+
+    threshold = ((uint64_t)schedulerStats.jobs * percentile + 99) / 100;
+    for (uint8_t i = 0; i < LATENESS_BUCKETS; i++) {
+        count += schedulerStats.histogram[i];
+        if (count >= threshold) {
+            bound = i ? ((1UL << i) - 1) : 0;
+            return bound < schedulerStats.maxMillis ? bound : schedulerStats.maxMillis;
+        }
     }
+    return schedulerStats.maxMillis;
 }
 
 
 // check for scheduled jobs
 bool jobs_scheduled() {
-    return scheduledjobs != NULL;
+    return jobs_pending() > 0;
+}
+
+
+// returns number of jobs in queue which haven't been preempted
+uint16_t jobs_pending() {
+    uint16_t pending = 0;
+
+    for (uint8_t i = 0; i < JOB_PRIORITIES; i++)
+        pending += classJobs[i];
+    return pending;
+}
+
+
+// iterate pending jobs in order of deadline without copying the queue, 
+// returns job following the given one (time and seq set to 0 for the
+// first job); O(n) per call, meant for previews
+bool jobs_next(valvejob_t* job) {
+    uint16_t next = JOB_FREE;
+
+    for (uint16_t i = 0; i < MAX_JOBS; i++) {
+        if (valvejobs[i].pos == JOB_FREE || !job_live(i))
+            continue;
+        if (valvejobs[i].time < job->time || (valvejobs[i].time == job->time && 
+                (job->time || job->seq) && (int32_t)(valvejobs[i].seq - job->seq) <= 0))
+            continue;
+        if (next == JOB_FREE || job_before(i, next))
+            next = i;
+    }
+    if (next == JOB_FREE)
+        return false;
+    *job = valvejobs[next];
+    return true;
+}
+
+
+// check for a pending job switching a relay to given state
+// which is due by given time, O(n)
+bool jobs_due(uint64_t time, bool state) {
+    for (uint16_t i = 0; i < MAX_JOBS; i++) {
+        if (valvejobs[i].pos != JOB_FREE && job_live(i) && 
+                valvejobs[i].state == state && valvejobs[i].time <= time)
+            return true;
+    }
+    return false;
+}
+
+
+// copy up to max pending jobs in order of deadline, so the 
+// earliest due jobs are kept if there are more; O(n * max)
+uint16_t jobs_list(valvejob_t* jobs, uint16_t max) {
+    valvejob_t job;
+    uint16_t n = 0;
+
+    job.time = 0;
+    job.seq = 0;
+    while (n < max && jobs_next(&job))
+        jobs[n++] = job;
+    return n;
 }
@@ -22,21 +22,350 @@
 #include "prefs.h"
 #include "config.h"
 #include "logging.h"
+#include "hal.h"
+#include "adcstream.h"
+#include "ultrasonic.h"
+#include "filter.h"
+#include "currentdetect.h"
+#include "rtc.h"
+#include <atomic>
 
 
 #ifdef HAS_HTU21D
 static HTU21D  htu21(HTU21D_RES_RH12_TEMP14);
 static bool htu21Ready = false;
 #endif
+static filter_t moistureFilter[NUM_MOISTURE_SENSORS];
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-static UltraSonicDistanceSensor hcrs04(US_TRIGGER_PIN, US_ECHO_PIN);
+static filter_t waterLevelFilter;
 #endif
-static uint16_t moistureMA[NUM_MOISTURE_SENSORS][MOISTURE_MA_WINDOW_SIZE];
-sensorReadings_t sensors;
+
+// readings are only written by sensor task and published as 
+// snapshot through a seqlock, so readers on other tasks never
+// block and always get a consistent set of readings
+static sensorReadings_t readings;
+static sensorReadings_t snapshot;
+static std::atomic<uint32_t> snapshotSeq(0);
+static std::atomic<bool> reconfigure(false);
+static std::atomic<bool> active(false);
+
+// per sensor sampling budget, baseline is the fixed cadence used to 
+// count samples saved: all sensors were read every SAMPLE_BASELINE_MS
+// before adaptive sampling (water level additionally on MQTT publish)
+#define SAMPLE_BASELINE_MS 15000
+
+typedef struct {
+    uint32_t activeMs;
+    uint32_t idleMs;
+    uint32_t baselineMs;
+    uint32_t interval;
+    uint32_t last;
+    std::atomic<uint32_t> taken;
+} sampling_t;
+
+enum { SAMPLE_LEVEL, SAMPLE_MOISTURE, SAMPLE_TEMP, SAMPLE_SENSORS };
+static sampling_t sampling[SAMPLE_SENSORS] = {
+    { WATER_LEVEL_ACTIVE_MS, WATER_LEVEL_IDLE_MS, SAMPLE_BASELINE_MS, WATER_LEVEL_ACTIVE_MS, 0, {0} },
+    { MOISTURE_ACTIVE_MS, MOISTURE_IDLE_MS, SAMPLE_BASELINE_MS, MOISTURE_ACTIVE_MS, 0, {0} },
+    { TEMP_ACTIVE_MS, TEMP_IDLE_MS, SAMPLE_BASELINE_MS, TEMP_ACTIVE_MS, 0, {0} }
+};
+static uint64_t samplingSince = 0;
+static bool adcRunning = false, adcFailed = false;
+
+// sensor settings used by sensor task, copied from switchesPrefs at start 
+// up and on reconfigure; switchesPrefs is changed by the web ui on the 
+// other core and only complete once sensorsChanged() has been called
+typedef struct {
+    int8_t pinMoisture[NUM_MOISTURE_SENSORS];
+    uint16_t moistureMin;
+    uint16_t moistureMax;
+    bool moistureRaw;
+    bool moistureMovingAvg;
+    uint8_t waterReservoirHeight;
+} sensorPrefs_t;
+
+static sensorPrefs_t sensorPrefs;
+
+
+static void copySensorPrefs() {
+    memcpy(sensorPrefs.pinMoisture, switchesPrefs.pinMoisture, sizeof(sensorPrefs.pinMoisture));
+    sensorPrefs.moistureMin = switchesPrefs.moistureMin;
+    sensorPrefs.moistureMax = switchesPrefs.moistureMax;
+    sensorPrefs.moistureRaw = switchesPrefs.moistureRaw;
+    sensorPrefs.moistureMovingAvg = switchesPrefs.moistureMovingAvg;
+    sensorPrefs.waterReservoirHeight = switchesPrefs.waterReservoirHeight;
+}
+
+
+// (re)start continuous sampling of moisture sensors and pump
+// current, falls back to analogRead() if ADC1 stream isn't available
+static bool initADCSampling() {
+#ifdef ADC_CONTINUOUS
+    int8_t pins[NUM_MOISTURE_SENSORS+1];
+    uint8_t n = 0;
+
+    for (uint8_t i = 0; i < NUM_MOISTURE_SENSORS; i++) {
+        if (sensorPrefs.pinMoisture[i] > 0)
+            pins[n++] = sensorPrefs.pinMoisture[i];
+    }
+#ifdef PUMP_CURRENT_PIN
+    pins[n++] = PUMP_CURRENT_PIN;
+#endif
+    return adcStreamBegin(pins, n);
+#else
+    return false;
+#endif
+}
+
+
+// moving average setting selects filter or raw readings
+static void initMoistureFilter() {
+    static const filtertype_t filters[NUM_MOISTURE_SENSORS] = {
+        MOIST1_FILTER, MOIST2_FILTER, MOIST3_FILTER, MOIST4_FILTER
+    };
+
+    for (uint8_t i = 0; i < NUM_MOISTURE_SENSORS; i++)
+        filterInit(&moistureFilter[i], sensorPrefs.moistureMovingAvg ? 
+            filters[i] : FILTER_NONE, MOISTURE_FILTER_SIZE);
+}
+
+
+// read temperature/humidity from I2C sensor htu21D
+static void readTemp() {
+#ifdef HAS_HTU21D
+    if (htu21Ready) {
+        readings.temperature = htu21.readTemperature();
+        readings.humidity = (uint8_t)htu21.readCompensatedHumidity();
+    }
+#endif
+}
+
+
+// pick up result of last ultrasonic ping (HC-SR04)
+// only takes a few microseconds
+static void pollWaterLevel() {
+#if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
+    static uint8_t errors = 0;
+    int16_t distance;
+
+    if (!usRange(&distance))
+        return;
+
+    // drop out of range readings, 
+    // outliers are taken care of by filter
+    if (distance <= 0 || distance > WATER_RESERVOIR_HEIGHT * 11 / 10) {
+        if (errors++ >= 3) {
+            readings.waterLevel = -1;
+        }
+    } else {
+        distance = filterUpdate(&waterLevelFilter, distance);
+        readings.waterLevel = sensorPrefs.waterReservoirHeight - distance;
+        errors = 0;       
+    }
+#endif
+}
+
+
+// read capacitive soil moisture sensor(s) v1.2 using ADC
+static void readMoisture() {
+    int16_t reading;
+
+    analogReadResolution(10);
+    for (uint8_t i = 0; i < NUM_MOISTURE_SENSORS; i++) {
+        if (sensorPrefs.pinMoisture[i] > 0) {
+            if (adcStreaming(sensorPrefs.pinMoisture[i])) {
+                // already averaged 12 bit value, scale to 10 bit
+                reading = adcStreamValue(sensorPrefs.pinMoisture[i], 0);
+                if (reading > 0)
+                    reading >>= 2;
+            } else {
+                reading = 0;
+                for (uint8_t j = 0; j < 10; j++) { // average readings
+                    reading += hal.adcRead(sensorPrefs.pinMoisture[i]);
+                    hal.delayMs(5);
+                }
+                reading /= 10;
+            }
+
+            // sensor not connected
+            if (reading < sensorPrefs.moistureMin/2) {
+                reading = -1;
+                filterInit(&moistureFilter[i], (filtertype_t)moistureFilter[i].type, MOISTURE_FILTER_SIZE);
+            }
+
+            // optionally filter readings to avoid jumpy values
+            if (reading >= 0)
+                reading = filterUpdate(&moistureFilter[i], reading);
+            readings.moistureReading[i] = reading;
+
+            if (!sensorPrefs.moistureRaw && reading >= 0) {
+                readings.moisture[i] = map(reading, sensorPrefs.moistureMin, 
+                    sensorPrefs.moistureMax, 0, 100);
+                if (readings.moisture[i] < 0)
+                    readings.moisture[i] = 0;
+                if (readings.moisture[i] > 100)
+                    readings.moisture[i] = 100;
+            } else {
+                readings.moisture[i] = reading;
+            }
+        }
+    }
+}
+
+
+// read pump current (mA) from ACS712 style hall sensor
+static void readPumpCurrent() {
+#ifdef PUMP_CURRENT_PIN
+    int32_t reading = 0;
+
+    if (adcStreaming(PUMP_CURRENT_PIN)) {
+        reading = adcStreamValue(PUMP_CURRENT_PIN, 1);  // most recent block
+        if (reading < 0)
+            return;
+        reading >>= (12 - PUMP_CURRENT_ADC_BITS);  // stream is 12 bit
+    } else {
+        analogReadResolution(PUMP_CURRENT_ADC_BITS);  // moisture uses 10 bit
+        for (uint8_t i = 0; i < 4; i++)
+            reading += hal.adcRead(PUMP_CURRENT_PIN);
+        reading /= 4;
+    }
+    readings.pumpCurrent = currentFromADC(reading, PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_UA_PER_STEP);
+#endif
+}
+
+
+// seqlock writer, sequence is odd while snapshot is updated
+static void publishReadings() {
+    uint32_t seq = snapshotSeq.load(std::memory_order_relaxed);
+
+    snapshotSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&snapshot, &readings, sizeof(snapshot));
+    snapshotSeq.store(seq + 2, std::memory_order_release);
+}
+
+
+// consistent copy of latest sensor readings, never blocks; retries
+// only if sensor task publishes at the very same time
+sensorReadings_t sensorSnapshot() {
+    sensorReadings_t copy;
+    uint32_t seq;
+
+    do {
+        seq = snapshotSeq.load(std::memory_order_acquire);
+        memcpy(&copy, &snapshot, sizeof(copy));
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != snapshotSeq.load(std::memory_order_relaxed));
+    return copy;
+}
+
+
+// pin or filter settings changed, picked up by sensor task
+void sensorsChanged() {
+    reconfigure = true;
+}
+
+
+// pump or valves switched, called by relay control
+void sensorsActivity(bool on) {
+    active = on;
+}
+
+
+// number of samples taken by all sensors and number of samples 
+// saved compared to sampling at a fixed rate (baseline)
+void sensorSamples(uint32_t* taken, uint32_t* saved) {
+    uint64_t elapsed = getUptimeMillis() - samplingSince;
+    uint32_t n;
+
+    *taken = 0;
+    *saved = 0;
+    for (uint8_t i = 0; i < SAMPLE_SENSORS; i++) {
+#if !defined(US_TRIGGER_PIN) || !defined(US_ECHO_PIN)
+        if (i == SAMPLE_LEVEL)
+            continue;
+#endif
+#ifndef HAS_HTU21D
+        if (i == SAMPLE_TEMP)
+            continue;
+#endif
+        n = sampling[i].taken;
+        *taken += n;
+        if (elapsed / sampling[i].baselineMs > n)
+            *saved += elapsed / sampling[i].baselineMs - n;
+    }
+}
+
+
+// check if sensor sample is due; sampling rate is raised immediately
+// if system becomes active and decays once it's idle again
+static bool sampleDue(sampling_t* s, uint32_t now, bool on) {
+    if (on && s->interval > s->activeMs)
+        s->interval = s->activeMs;
+    if ((now - s->last) < s->interval)
+        return false;
+    s->last = now;
+    s->taken++;
+    if (!on)
+        s->interval = min(s->interval * 2, s->idleMs);
+    return true;
+}
+
+
+// samples all sensors on an adaptive cadence, pinned to the core
+// not running the main loop; the only task accessing sensor hardware
+static void sensorTask(void* param) {
+    sampling_t* moisture = &sampling[SAMPLE_MOISTURE];
+    bool on, adc;
+    uint32_t now;
+
+    for (;;) {
+        now = millis();
+        on = active;
+        if (reconfigure.exchange(false)) {
+            copySensorPrefs();
+            adcStreamEnd();
+            adcRunning = adcFailed = false;
+            initMoistureFilter();
+        }
+
+        // ADC stream only runs while pump current is needed
+        // or ahead of next moisture sample to fill ring buffer
+        adc = on || (now - moisture->last) + ADC_WARMUP_MS >= moisture->interval;
+        if (adc && !adcRunning && !adcFailed) {
+            adcRunning = initADCSampling();
+            adcFailed = !adcRunning;
+        } else if (!adc && adcRunning) {
+            adcStreamEnd();
+            adcRunning = false;
+        }
+        adcStreamPoll();
+
+        if (on)
+            readPumpCurrent();
+        else
+            readings.pumpCurrent = 0;
+#if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
+        pollWaterLevel();
+        if (sampleDue(&sampling[SAMPLE_LEVEL], now, on))
+            usPing();
+#endif
+#ifdef HAS_HTU21D
+        if (sampleDue(&sampling[SAMPLE_TEMP], now, on))
+            readTemp();
+#endif
+        if (sampleDue(moisture, now, on))
+            readMoisture();
+        publishReadings();
+        vTaskDelay(pdMS_TO_TICKS(SENSOR_TASK_TICK_MS));
+    }
+}
 
 
 void initSensors() {
     bool adc_inited = false;
+
+    copySensorPrefs();
 #ifdef HAS_HTU21D
     Serial.print(millis());
     if (!htu21.begin()) {
@@ -59,26 +388,56 @@ void initSensors() {
         }
     }
     Serial.println();
-    delay(750);
-    readMoisture(true, false, false);
+#ifdef PUMP_CURRENT_PIN
+    adcAttachPin(PUMP_CURRENT_PIN);
+#endif
+    Serial.print(millis());
+    adcRunning = initADCSampling();
+    adcFailed = !adcRunning;
+    if (adcRunning)
+        Serial.println(F(": Continuous ADC sampling started"));
+    else
+        Serial.println(F(": Continuous ADC sampling not available"));
+    initMoistureFilter();
+    hal.delayMs(750);
+
+    // initial readings before sensor task takes over
+    adcStreamPoll();
+    readTemp();
+    readMoisture();
+    readPumpCurrent();
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-    sensors.waterLevel = -1;
+    readings.waterLevel = -1;
+    filterInit(&waterLevelFilter, WATER_LEVEL_FILTER, WATER_LEVEL_FILTER_SIZE);
+    usBegin(US_TRIGGER_PIN, US_ECHO_PIN);
+    for (uint8_t i = 0; i < 3; i++) {  // prime outlier filter
+        usPing();
+        hal.delayMs(US_TIMEOUT_US / 1000);
+        pollWaterLevel();
+    }
 #endif
+    publishReadings();
+
+    samplingSince = getUptimeMillis();
+    for (uint8_t i = 0; i < SAMPLE_SENSORS; i++)
+        sampling[i].last = millis();
+    xTaskCreatePinnedToCore(sensorTask, "sensors", SENSOR_TASK_STACK, NULL, 
+        SENSOR_TASK_PRIO, NULL, SENSOR_TASK_CORE);
 }
 
 
-// read temperature/humidity from I2C sensor htu21D
-void readTemp(bool verbose, bool log) {
+// print and/or log temperature/humidity
+void reportTemp(bool verbose, bool log) {
 #ifdef HAS_HTU21D
+    sensorReadings_t sensors = sensorSnapshot();
     char logmsg[32], temp[8];
+
     if (htu21Ready) {
-        sensors.temperature = htu21.readTemperature();
-        sensors.humidity = (uint8_t)htu21.readCompensatedHumidity();
         if (verbose) {
             Serial.print(millis());
             Serial.print(F(": Temperature: "));
             Serial.print(sensors.temperature, 1);
-            Serial.printf(" °C, relative humidity %d %%", sensors.humidity);
+            Serial.printf(" °C, relative humidity %d %%\n", sensors.humidity);
         }
         if (log) {
             dtostrf(sensors.temperature, 4, 1, temp);
@@ -90,33 +449,12 @@ void readTemp(bool verbose, bool log) {
 }
 
 
-// read water level using HC-SR04 ultrasonic sensor
-void readWaterLevel(bool verbose, bool log) {
+// print and/or log water level
+void reportWaterLevel(bool verbose, bool log) {
 #if defined(US_TRIGGER_PIN) && defined(US_ECHO_PIN)
-    static int16_t prevDistance = 0;
-    static uint8_t errors = 0;
-    int16_t distance = int(hcrs04.measureDistanceCm());
+    sensorReadings_t sensors = sensorSnapshot();
     char logmsg[32];
 
-    // first run at system startup
-    if (!prevDistance) {
-        delay(100);
-        distance = int(hcrs04.measureDistanceCm());
-        prevDistance = distance;
-    }
-
-    // try to avoid jumpy water level values due to invalid readings
-    if (distance <= 0 || (abs(prevDistance-distance)*100/distance) > 25 || 
-            distance > (WATER_RESERVOIR_HEIGHT * 1.1)) {
-        if (errors++ >= 3) {
-            sensors.waterLevel = -1;
-        }
-    } else {
-        sensors.waterLevel = switchesPrefs.waterReservoirHeight - distance;
-        errors = 0;       
-    }
-    prevDistance = distance;
-
     if (verbose) {
         Serial.print(millis());
         if (sensors.waterLevel > 0)
@@ -132,62 +470,15 @@ void readWaterLevel(bool verbose, bool log) {
 }
 
 
-// read capacitive soil moisture sensor(s) v1.2 using ADC
-void readMoisture(bool verbose, bool log, bool reset) {
-    int16_t reading = 0;
+// print and/or log soil moisture
+void reportMoisture(bool verbose, bool log) {
+    sensorReadings_t sensors = sensorSnapshot();
     static char logmsg[64], buf[16];
     uint8_t len = 0;
-    static uint16_t moistureMAReadings[NUM_MOISTURE_SENSORS][MOISTURE_MA_WINDOW_SIZE];
-    static uint16_t moistureMASum[NUM_MOISTURE_SENSORS];
-    static uint8_t mindex = 0;
-    static bool mvgAvgReady = false;
-
-    // reset moving average readings
-    if (reset && switchesPrefs.moistureMovingAvg) {
-        memset (moistureMAReadings, -1, 
-            sizeof(moistureMAReadings[0][0]) * NUM_MOISTURE_SENSORS * MOISTURE_MA_WINDOW_SIZE);
-        memset(moistureMASum, 0, sizeof(moistureMASum[0]) * NUM_MOISTURE_SENSORS);
-        mvgAvgReady = false;
-        mindex = 0;
-    }
 
-    analogReadResolution(10);
     memset(logmsg, 0, sizeof(logmsg));
     for (uint8_t i = 0; i < NUM_MOISTURE_SENSORS; i++) {
         if (switchesPrefs.pinMoisture[i] > 0) {
-            for (uint8_t j = 0; j < 10; j++) { // average readings
-                reading += analogRead(switchesPrefs.pinMoisture[i]);
-                delay(5);
-            }
-            reading /= 10;
-
-            // sensor not connected
-            if (reading < switchesPrefs.moistureMin/2) {
-                reading = -1;
-                moistureMASum[i] = 0;
-            }
-
-            // optionally calculate moving average to avoid jumpy readings
-            if (switchesPrefs.moistureMovingAvg && reading >= 0) {
-                moistureMASum[i] -= moistureMAReadings[i][mindex];
-                moistureMAReadings[i][mindex] = reading;
-                moistureMASum[i] += reading;
-                // don't calc moving avg unless array is filled with readings
-                if (moistureMAReadings[i][MOISTURE_MA_WINDOW_SIZE-1] > 0 && mvgAvgReady)
-                    reading = moistureMASum[i] / MOISTURE_MA_WINDOW_SIZE;
-            }
-
-            if (!switchesPrefs.moistureRaw && reading >= 0) {
-                sensors.moisture[i] = map(reading, switchesPrefs.moistureMin, 
-                    switchesPrefs.moistureMax, 0, 100);
-                if (sensors.moisture[i] < 0)
-                    sensors.moisture[i] = 0;
-                if (sensors.moisture[i] > 100)
-                    sensors.moisture[i] = 100;
-            } else {
-                sensors.moisture[i] = reading;
-            }
-
             if (verbose) {
                 Serial.print(millis());
                 Serial.printf(": Soil moisture %s: ", switchesPrefs.labelMoisture[i]);
@@ -197,8 +488,8 @@ void readMoisture(bool verbose, bool log, bool reset) {
                     Serial.printf("%d%%", sensors.moisture[i]);
                 else
                     Serial.print("n/a");
-                if (!switchesPrefs.moistureRaw && reading >=0)
-                    Serial.printf(" (raw %d)\n", reading); 
+                if (!switchesPrefs.moistureRaw && sensors.moistureReading[i] >=0)
+                    Serial.printf(" (raw %d)\n", sensors.moistureReading[i]); 
                 else
                     Serial.println();
             }
@@ -211,16 +502,9 @@ void readMoisture(bool verbose, bool log, bool reset) {
             }
         }
     }
-    // increment moving avg index, and wrap to 0 if it exceeds the window size
-    if (switchesPrefs.moistureMovingAvg) {
-        mindex = (mindex + 1) % MOISTURE_MA_WINDOW_SIZE;
-        if ((mindex + 1) == MOISTURE_MA_WINDOW_SIZE)
-            mvgAvgReady = true; // array filled, ready to use moving average values
-    }
-
     len = strlen(logmsg);
     if (len > 2) {
         logmsg[len-2] = '\0'; // remove trailing ', '
         logMsg(logmsg);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,101 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "ultrasonic.h"
+
+// non-blocking HC-SR04 driver, usPing() only emits the trigger pulse,
+// the echo pulse is timed by a GPIO interrupt on both edges and picked
+// up by usRange() once available; so a level check takes microseconds 
+// instead of blocking the main loop for the duration of the echo
+static int8_t trigger = -1, echo = -1;
+static volatile uint32_t echoStart = 0;
+static volatile uint32_t echoWidth = 0;
+static volatile bool echoDone = false;
+static uint32_t pingAt = 0;
+static bool pinging = false;
+
+// the ISR runs on the core which called usBegin(), usPing() and usRange() 
+// may be called on the other one, so noInterrupts() wouldn't do
+static portMUX_TYPE echoMux = portMUX_INITIALIZER_UNLOCKED;
+
+
+static void IRAM_ATTR echoISR() {
+    uint32_t now = micros();
+
+    portENTER_CRITICAL_ISR(&echoMux);
+    if (digitalRead(echo)) {
+        echoStart = now;
+    } else if (echoStart) {
+        echoWidth = now - echoStart;
+        echoDone = true;
+    }
+    portEXIT_CRITICAL_ISR(&echoMux);
+}
+
+
+void usBegin(int8_t triggerPin, int8_t echoPin) {
+    trigger = triggerPin;
+    echo = echoPin;
+    pinMode(trigger, OUTPUT);
+    digitalWrite(trigger, LOW);
+    pinMode(echo, INPUT);
+    attachInterrupt(digitalPinToInterrupt(echo), echoISR, CHANGE);
+}
+
+
+// trigger new measurement unless one is still pending
+bool usPing() {
+    if (trigger < 0 || (pinging && (micros() - pingAt) < US_TIMEOUT_US))
+        return false;
+
+    portENTER_CRITICAL(&echoMux);
+    echoStart = 0;
+    echoDone = false;
+    portEXIT_CRITICAL(&echoMux);
+    digitalWrite(trigger, HIGH);
+    delayMicroseconds(US_TRIGGER_US);
+    digitalWrite(trigger, LOW);
+    pingAt = micros();
+    pinging = true;
+    return true;
+}
+
+
+// fetch result of last ping, returns false while still pending or 
+// if already fetched; distance in cm or -1 if echo timed out
+bool usRange(int16_t* distance) {
+    uint32_t width;
+
+    if (!pinging)
+        return false;
+    if (echoDone) {
+        portENTER_CRITICAL(&echoMux);
+        width = echoWidth;
+        echoDone = false;
+        portEXIT_CRITICAL(&echoMux);
+        *distance = (width < US_ECHO_MAX_US) ? (width / US_US_PER_CM) : -1;
+    } else if ((micros() - pingAt) >= US_TIMEOUT_US) {
+        *distance = -1;
+    } else {
+        return false;
+    }
+    pinging = false;
+    return true;
+}
@@ -0,0 +1,163 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#include "config.h"
+#include "usage.h"
+#include "relay.h"
+#include "rtc.h"
+
+// RTC slow memory survives watchdog resets, exceptions
+// and soft restarts but isn't initialized on power up
+static RTC_NOINIT_ATTR waterUsage_t rtcUsage;
+
+
+// FNV-1a hash over usage counters excluding checksum
+static uint32_t usageChecksum(const waterUsage_t* usage) {
+    const uint8_t* data = (const uint8_t*)usage;
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < offsetof(waterUsage_t, checksum); i++)
+        hash = (hash ^ data[i]) * 16777619UL;
+    return hash;
+}
+
+
+// keep counters from before a soft restart, reset them on power up
+void initUsage() {
+    if (rtcUsage.magic == USAGE_MAGIC && rtcUsage.checksum == usageChecksum(&rtcUsage)) {
+        Serial.printf("Restored water usage (%lu liters total)\n", (unsigned long)(rtcUsage.total[0].ml / 1000));
+        return;
+    }
+    memset(&rtcUsage, 0, sizeof(rtcUsage));
+    rtcUsage.magic = USAGE_MAGIC;
+    rtcUsage.checksum = usageChecksum(&rtcUsage);
+}
+
+
+// start new daily/weekly buckets if local day has changed,
+// buckets of days without irrigation are cleared
+static void usageRoll() {
+    time_t local = getLocalTime();
+    uint32_t day, week;
+
+    if (local < 1609455600)  // RTC not set yet
+        return;
+    day = local / 86400;
+    week = (day + 3) / 7;  // 01/01/1970 was a thursday
+    if (day == rtcUsage.day)
+        return;
+
+    if (!rtcUsage.day || day < rtcUsage.day || (day - rtcUsage.day) >= USAGE_DAYS) {
+        memset(rtcUsage.days, 0, sizeof(rtcUsage.days));
+    } else {
+        for (uint32_t d = rtcUsage.day + 1; d <= day; d++)
+            memset(rtcUsage.days[d % USAGE_DAYS], 0, sizeof(rtcUsage.days[0]));
+    }
+
+    if (week != rtcUsage.week) {
+        if (rtcUsage.day && week == rtcUsage.week + 1)
+            memcpy(rtcUsage.lastWeek, rtcUsage.thisWeek, sizeof(rtcUsage.lastWeek));
+        else
+            memset(rtcUsage.lastWeek, 0, sizeof(rtcUsage.lastWeek));
+        memset(rtcUsage.thisWeek, 0, sizeof(rtcUsage.thisWeek));
+        rtcUsage.week = week;
+    }
+    rtcUsage.day = day;
+    rtcUsage.checksum = usageChecksum(&rtcUsage);
+}
+
+
+static void addUsage(valveUsage_t* usage, uint8_t relay, uint32_t secs, uint32_t ml) {
+    usage[relay].secs += secs;
+    usage[relay].ml += ml;
+    usage[0].secs += secs;
+    usage[0].ml += ml;
+}
+
+
+// account valve run of given duration, volume is derived from
+// the measured flow rate of the valve (l/min) if known; the flow
+// demand used to share the pump is just an upper bound
+void usageAdd(uint8_t relay, uint32_t millis) {
+    uint32_t secs = (millis + 500) / 1000;
+    uint32_t ml;
+
+    if (!relay || relay > NUM_RELAY)
+        return;
+    ml = (uint64_t)millis * switchesPrefs.rateRelay[relay-1] / 60;
+
+    usageRoll();
+    addUsage(rtcUsage.total, relay, secs, ml);
+    if (rtcUsage.day) {
+        addUsage(rtcUsage.days[rtcUsage.day % USAGE_DAYS], relay, secs, ml);
+        addUsage(rtcUsage.thisWeek, relay, secs, ml);
+    }
+    rtcUsage.checksum = usageChecksum(&rtcUsage);
+}
+
+
+// liters used by valve (0 for all) as json value, null if a
+// valve which has been used has no flow rate set
+static const char* usageLiters(const valveUsage_t* usage, uint8_t relay, char* buf, size_t s) {
+    if (relay && !switchesPrefs.rateRelay[relay-1])
+        return "null";
+    for (uint8_t i = 1; !relay && i <= NUM_RELAY; i++) {
+        if (usage[i].secs > 0 && !switchesPrefs.rateRelay[i-1])
+            return "null";
+    }
+    snprintf(buf, s, "%lu", (unsigned long)(usage[relay].ml / 1000));
+    return buf;
+}
+
+
+// return water usage as json string, e.g. 
+// {"today":{"valve1":[secs,liters],...},"week":{...},...}
+// liters are null unless flow rates are set (RELAYn_RATE)
+uint16_t usageStatus(char* buf, size_t s) {
+    const char* periods[] = { "today", "week", "lastweek", "total" };
+    const valveUsage_t* usage[4];
+    char liters[12];
+    size_t len = 0;
+
+    usageRoll();
+    if (rtcUsage.day) {
+        usage[0] = rtcUsage.days[rtcUsage.day % USAGE_DAYS];
+        usage[1] = rtcUsage.thisWeek;
+        usage[2] = rtcUsage.lastWeek;
+    } else {
+        usage[0] = usage[1] = usage[2] = NULL;  // RTC not set yet
+    }
+    usage[3] = rtcUsage.total;
+
+    len += snprintf(buf + len, s - len, "{");
+    for (uint8_t p = 0; p < 4 && len < s; p++) {
+        len += snprintf(buf + len, s - len, "%s\"%s\":{", p ? "," : "", periods[p]);
+        for (uint8_t i = 0; i <= NUM_RELAY && len < s; i++) {
+            len += snprintf(buf + len, s - len, "%s\"%s\":[%lu,%s]", i ? "," : "",
+                i ? pinnames[i] : "all", usage[p] ? (unsigned long)usage[p][i].secs : 0UL,
+                usage[p] ? usageLiters(usage[p], i, liters, sizeof(liters)) : "0");
+        }
+        if (len < s)
+            len += snprintf(buf + len, s - len, "}");
+    }
+    if (len < s)
+        len += snprintf(buf + len, s - len, "}");
+    return (len < s) ? len : 0;
+}
@@ -29,6 +29,9 @@
 #include "mqtt.h"
 #include "sensors.h"
 #include "prefs.h"
+#include "scheduler.h"
+#include "programs.h"
+#include "usage.h"
 
 #ifdef LANG_DE
 #include "html_DE.h"
@@ -38,6 +41,7 @@
 
 static uint32_t webserverRequestMillis = 0;
 static uint16_t webserverTimeout = 0;
+static uint32_t bootTag = 0;  // keeps ETags of different boots apart
 
 WebServer webserver(80);
 
@@ -46,6 +50,7 @@ WebServer webserver(80);
 static void updateUI() {
     static char buf[192], label[16];
     static StaticJsonDocument<384> JSON;
+    sensorReadings_t sensors = sensorSnapshot();
 
     memset(buf, 0, sizeof(buf));
     JSON.clear();
@@ -88,7 +93,150 @@ static void updateUI() {
 }
 
 
-void webserver_start() {
+// pass job queue status and dispatch lateness as JSON
+static void schedulerStatus() {
+    static char buf[160];
+    static StaticJsonDocument<192> JSON;
+
+    JSON.clear();
+    JSON["pending"] = jobs_pending();
+    JSON["jobs"] = schedulerStats.jobs;
+    if (schedulerStats.jobs > 0) {
+        JSON["min"] = schedulerStats.minMillis;
+        JSON["avg"] = (uint32_t)(schedulerStats.sumMillis / schedulerStats.jobs);
+        JSON["p99"] = scheduler_lateness(99);
+        JSON["max"] = schedulerStats.maxMillis;
+    }
+
+    if (serializeJson(JSON, buf) > 0)
+        webserver.send(200, F("application/json"), buf);
+    else
+        webserver.send(500, "text/plain", "ERR");
+}
+
+
+// pass irrigation programs, their next start (UTC) and conflicts as JSON
+static void programsStatus() {
+    static char buf[2048];
+    static StaticJsonDocument<2560> JSON;
+    static programConflict_t conflicts[MAX_CONFLICTS];
+    JsonObject program;
+    JsonArray secs, conflicted;
+    uint8_t n;
+
+    JSON.clear();
+    n = min(checkPrograms(conflicts, MAX_CONFLICTS), (uint8_t)MAX_CONFLICTS);
+    for (uint8_t i = 0; i < MAX_PROGRAMS; i++) {
+        program = JSON.createNestedObject();
+        program["program"] = i + 1;
+        program["enabled"] = switchesPrefs.irrigationPrograms[i].enabled ? 1 : 0;
+        program["weekdays"] = switchesPrefs.irrigationPrograms[i].weekdays;
+        program["starts"] = programStartsString(i);
+        secs = program.createNestedArray("secs");
+        for (uint8_t j = 0; j < NUM_RELAY; j++)
+            secs.add(switchesPrefs.irrigationPrograms[i].secs[j]);
+        program["next"] = nextProgramStart(i);
+        conflicted = program.createNestedArray("conflicts");
+        for (uint8_t j = 0; j < n; j++) {
+            if (conflicts[j].prog == i + 1)
+                conflicted.add(programConflictString(&conflicts[j]));
+        }
+    }
+
+    if (serializeJson(JSON, buf) > 0)
+        webserver.send(200, F("application/json"), buf);
+    else
+        webserver.send(500, "text/plain", "ERR");
+}
+
+
+// stream upcoming valve events as JSON array, number of events 
+// given by arg n, optionally limited to given number of days ahead
+static void schedulePreview() {
+    static schedulePreview_t preview;
+    previewEvent_t ev;
+    char buf[112];
+    uint16_t n = PREVIEW_DEFAULT_EVENTS, days = webserver.arg("days").toInt();
+    size_t len;
+
+    if (webserver.arg("n").length() > 0)
+        n = constrain(webserver.arg("n").toInt(), 0, PREVIEW_MAX_EVENTS);
+    previewBegin(&preview);
+    if (days > 0 && days < PREVIEW_MAX_DAYS)
+        preview.until = preview.now + days * 86400;
+
+    webserver.setContentLength(CONTENT_LENGTH_UNKNOWN);
+    webserver.send(200, F("application/json"), "[");
+    for (uint16_t i = 0; i < n && previewNext(&preview, &ev); i++) {
+        len = (i > 0) ? sprintf(buf, ",") : 0;
+        len += previewEventString(&ev, buf + len, sizeof(buf) - len);
+        webserver.sendContent(buf, len);
+    }
+    webserver.sendContent("]");
+    webserver.sendContent("");  // terminate chunked transfer
+}
+
+
+// check irrigation programs for valve runs which would be 
+// deferred, skipped, blocked or autostopped; conflicts are 
+// logged if programs have been changed, returns HTML list
+static String programConflicts(bool saved) {
+    static programConflict_t conflicts[MAX_CONFLICTS];
+    String html;
+    uint8_t n;
+
+    n = checkPrograms(conflicts, MAX_CONFLICTS);
+    for (uint8_t i = 0; i < n && i < MAX_CONFLICTS; i++) {
+        html += programConflictString(&conflicts[i]);
+        html += "<br>";
+        if (saved) {
+            Serial.print(millis());
+            Serial.printf(": Conflict %s\n", programConflictString(&conflicts[i]));
+            logMsg(programConflictString(&conflicts[i]));
+        }
+    }
+    if (n > MAX_CONFLICTS)
+        html += "...";
+    return html;
+}
+
+
+// set irrigation program from form arguments
+static void setProgram(irrigationProgram_t* prog) {
+    char buf[32];
+
+    if (webserver.arg("irrigation_time").length() >= 5)
+        parseProgramStarts(prog, webserver.arg("irrigation_time").c_str());
+    prog->weekdays = 0;
+    for (uint8_t i = 0; i < 7; i++) {
+        sprintf(buf, "weekday%d", i);
+        if (webserver.arg(buf) == "on")
+            prog->weekdays |= (1 << i);
+    }
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        sprintf(buf, "irrigation_relay%d_secs", i);
+        if (webserver.arg(buf).toInt() >= 0 && webserver.arg(buf).toInt() <= switchesPrefs.pumpAutoStopSecs)
+            prog->secs[i-1] = webserver.arg(buf).toInt();
+    }
+}
+
+
+// repeat row template for each valve, replacing __N__ by the valve
+// number and __PIN__, __SECS__, __LABEL__ by its settings
+static String relayRows(const char* row) {
+    String rows, html;
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        html = FPSTR(row);
+        html.replace("__N__", String(i));
+        html.replace("__PIN__", String(switchesPrefs.pinRelay[i-1]));
+        html.replace("__SECS__", String(switchesPrefs.irrigationPrograms[0].secs[i-1]));
+        html.replace("__LABEL__", String(switchesPrefs.labelRelay[i-1]));
+        rows += html;
+    }
+    return rows;
+}
+
 
     // send main page
     webserver.on("/", HTTP_GET, []() {
@@ -99,11 +247,7 @@ void webserver_start() {
         html.replace("__SYSTEMID__", systemID());
         html.replace("__WATER_RESERVOIR_HEIGHT__", String(WATER_RESERVOIR_HEIGHT));
         html.replace("__MIN_WATER_LEVEL__", String(switchesPrefs.minWaterLevel));
-        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
-            sprintf(buf, "__RELAY%d_LABEL__", i);
-            html.replace(buf, String(switchesPrefs.labelRelay[i-1]));
-
-        }
+        html.replace("__VALVE_SWITCHES__", relayRows(VALVE_SWITCH_html));
         for (uint8_t i = 1; i <= NUM_MOISTURE_SENSORS; i++) {
             sprintf(buf, "__MOIST%d_LABEL__", i);
             html.replace(buf, String(switchesPrefs.labelMoisture[i-1]));
@@ -118,21 +262,70 @@ void webserver_start() {
     // AJAX request from main page to update readings
     webserver.on("/ui", HTTP_GET, updateUI);
 
+    // scheduler status, lateness in ms
+    webserver.on("/scheduler", HTTP_GET, schedulerStatus);
+
+    // list irrigation programs
+    webserver.on("/programs", HTTP_GET, programsStatus);
+
+    // change irrigation program given by arg program (1-4)
+    webserver.on("/programs", HTTP_POST, []() {
+        uint8_t prog = webserver.arg("program").toInt();
+
+        if (prog < 1 || prog > MAX_PROGRAMS) {
+            webserver.send(400, "text/plain", "ERR");
+            return;
+        }
+        logMsg("webui save program");
+        switchesPrefs.irrigationPrograms[prog-1].enabled = (webserver.arg("enabled") == "on");
+        setProgram(&switchesPrefs.irrigationPrograms[prog-1]);
+        nvs.putBool("switches", true);
+        nvs.putBytes(SWITCHES_PREFS_KEY, &switchesPrefs, sizeof(switchesPrefs));
+        updatePrograms();
+        programConflicts(true);
+        programsStatus();
+    });
+
+    // water usage per valve (secs, liters) today, this/last week and since power up
+    webserver.on("/api/usage", HTTP_GET, []() {
+        static char reply[USAGE_STATUS_SIZE];
+        if (usageStatus(reply, sizeof(reply)) > 0) {
+            webserver.send(200, F("application/json"), reply);
+        } else {
+            webserver.send(500, "text/plain", "ERR");
+        }
+    });
+
+    // upcoming valve events, e.g. /api/schedule/preview?n=50
+    webserver.on("/api/schedule/preview", HTTP_GET, schedulePreview);
+
     // set/check valves
     webserver.on("/valve", HTTP_GET, []() {
-        char reply[64];
-        if (webserver.arg("on").toInt() >= 1 && webserver.arg("on").toInt() <= 4) {
-            setRelay(webserver.arg("on").toInt(), true);
-        } else if (webserver.arg("off").toInt() >= 1 && webserver.arg("off").toInt() <= 4) {
-            setRelay(webserver.arg("off").toInt(), false);
+        const char* reply;
+        char etag[24];
+        uint16_t len;
+        // manual override cancels pending auto-irrigation, see relayCommands()
+        if (webserver.arg("on").toInt() >= 1 && webserver.arg("on").toInt() <= NUM_RELAY) {
+            requestRelay(webserver.arg("on").toInt(), true);
+        } else if (webserver.arg("off").toInt() >= 1 && webserver.arg("off").toInt() <= NUM_RELAY) {
+            requestRelay(webserver.arg("off").toInt(), false);
         }
-        if (relayStatus(reply, sizeof(reply)) > 0) {
-            webserver.send(200, F("application/json"), reply);
+        // status polled by web ui only sent if it has changed
+        snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned)bootTag, (unsigned)relayVersion());
+        webserver.sendHeader("Cache-Control", "no-cache");
+        webserver.sendHeader("ETag", etag);
+        if (webserver.header("If-None-Match") == etag) {
+            webserver.send(304);
+            return;
+        }
+        reply = relayStatus(&len);
+        if (len > 0) {
+            webserver.setContentLength(len);
+            webserver.send(200, F("application/json"), "");
+            webserver.sendContent(reply, len);
         } else {
             webserver.send(500, "text/plain", "ERR");
         }
-        if (webserver.arg("on").toInt() > 0 || webserver.arg("off").toInt() > 0)
-            mqtt_send(MQTT_TIMEOUT_MS); // publish changed relay settings
     });
 
     // show page with log files
@@ -298,12 +491,7 @@ void webserver_start() {
         html += PINS_html;
 
         html.replace("__RELAY_PINS__", RELAY_PINS);
-        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
-            sprintf(buf, "__RELAY%d_LABEL__", i);
-            html.replace(buf, String(switchesPrefs.labelRelay[i-1]));
-            sprintf(buf, "__RELAY%d_PIN__", i);
-            html.replace(buf, String(switchesPrefs.pinRelay[i-1]));
-        }
+        html.replace("__RELAY_NAMES__", relayRows(RELAY_NAME_html));
 
         html.replace("__MOISTURE_PINS__", MOISTURE_PINS);
         for (uint8_t i = 1; i <= NUM_MOISTURE_SENSORS; i++) {
@@ -373,11 +561,9 @@ void webserver_start() {
 
         // store settings in NVS     
         nvs.putBool("switches", true);
-        nvs.putBytes("switchesPrefs", &switchesPrefs, sizeof(switchesPrefs));
-
-        // reset moving average values
-        if (switchesPrefs.moistureMovingAvg)
-            readMoisture(true, false, true);     
+        nvs.putBytes(SWITCHES_PREFS_KEY, &switchesPrefs, sizeof(switchesPrefs));
+        relayStatusChanged();
+        sensorsChanged();  // restart ADC sampling, reset filters
 
         webserver.sendHeader("Location", "/pins?saved=1", true);
         webserver.send(302, "text/plain", "");
@@ -396,18 +582,19 @@ void webserver_start() {
             html.replace("__AUTO_IRRIGATION__", "checked");
         else
             html.replace("__AUTO_IRRIGATION__", "");
-        html.replace("__IRRIGATION_TIME__", String(switchesPrefs.autoIrrigationTime));
+        html.replace("__IRRIGATION_TIME__", String(programStartsString(0)));
         html.replace("__IRRIGATION_PAUSE__", String(switchesPrefs.autoIrrigationPauseHours));
-
-        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
-            sprintf(buf, "__RELAY%d_LABEL__", i);
-            html.replace(buf, String(switchesPrefs.labelRelay[i-1]));
-            sprintf(buf, "__IRRIGATION_RELAY%d_SECS__", i);
-            html.replace(buf, String(switchesPrefs.autoIrrigationSecs[i-1]));
+        html.replace("__PROGRAM_CONFLICTS__", programConflicts(false));
+        for (uint8_t i = 0; i < 7; i++) {
+            sprintf(buf, "__WEEKDAY%d__", i);
+            html.replace(buf, (switchesPrefs.irrigationPrograms[0].weekdays & (1 << i)) ? "checked" : "");
         }
 
+        html.replace("__IRRIGATION_RELAY_SECS__", relayRows(IRRIGATION_SECS_html));
+
         html.replace("__PUMP_AUTOSTOP__", String(switchesPrefs.pumpAutoStopSecs));
         html.replace("__PUMP_BLOCKTIME__", String(switchesPrefs.relaysBlockMins));
+        html.replace("__PUMP_CAPACITY__", String(switchesPrefs.pumpCapacity));
         html.replace("__RESERVOIR_HEIGHT__", String(switchesPrefs.waterReservoirHeight));
         html.replace("__MIN_WATER_LEVEL__", String(switchesPrefs.minWaterLevel));
 
@@ -432,28 +619,27 @@ void webserver_start() {
 
     // save main settings to NVS
     webserver.on("/config", HTTP_POST, []() {
-        char buf[32];
-
         logMsg("webui save main prefs");
         if (webserver.arg("auto_irrigation") == "on")
             switchesPrefs.enableAutoIrrigation = true;
         else
             switchesPrefs.enableAutoIrrigation = false;
 
-        if (webserver.arg("irrigation_time").length() == 5)
-            strncpy(switchesPrefs.autoIrrigationTime, webserver.arg("irrigation_time").c_str(), 5); 
+        // first irrigation program is set on this page
+        if (switchesPrefs.enableAutoIrrigation) {
+            switchesPrefs.irrigationPrograms[0].enabled = true;
+            setProgram(&switchesPrefs.irrigationPrograms[0]);
+        }
         if (webserver.arg("irrigation_pause").toInt() >= 1 && webserver.arg("irrigation_pause").toInt() <= 24)
             switchesPrefs.autoIrrigationPauseHours = webserver.arg("irrigation_pause").toInt();
-        for (uint8_t i = 1; i <= NUM_RELAY; i++) {
-            sprintf(buf, "irrigation_relay%d_secs", i);
-            if (webserver.arg(buf).toInt() >= 0 && webserver.arg(buf).toInt() <= switchesPrefs.pumpAutoStopSecs)
-                switchesPrefs.autoIrrigationSecs[i-1] = webserver.arg(buf).toInt();
-        }
 
         if (webserver.arg("pump_autostop").toInt() >= 10 && webserver.arg("pump_autostop").toInt() <= 300)
             switchesPrefs.pumpAutoStopSecs = webserver.arg("pump_autostop").toInt();
         if (webserver.arg("pump_blocktime").toInt() >= 10 && webserver.arg("pump_blocktime").toInt() <= 480)
             switchesPrefs.relaysBlockMins = webserver.arg("pump_blocktime").toInt();
+        if (webserver.arg("pump_capacity").length() > 0 && webserver.arg("pump_capacity").toInt() >= 0 &&
+                webserver.arg("pump_capacity").toInt() <= 9999)
+            switchesPrefs.pumpCapacity = webserver.arg("pump_capacity").toInt();
         if (webserver.arg("min_water_level").toInt() >= 4 && webserver.arg("min_water_level").toInt() <= 200)
             switchesPrefs.minWaterLevel = webserver.arg("min_water_level").toInt();    
         if (webserver.arg("reservoir_height").toInt() >= 10 && webserver.arg("reservoir_height").toInt() <= 200)
@@ -471,7 +657,11 @@ void webserver_start() {
 
         // store settings in NVS     
         nvs.putBool("switches", true);
-        nvs.putBytes("switchesPrefs", &switchesPrefs, sizeof(switchesPrefs));       
+        nvs.putBytes(SWITCHES_PREFS_KEY, &switchesPrefs, sizeof(switchesPrefs));       
+        relayStatusChanged();  // pump capacity
+        sensorsChanged();  // reservoir height
+        updatePrograms();
+        programConflicts(true);
 
         webserver.sendHeader("Location", "/config?saved=1", true);
         webserver.send(302, "text/plain", "");
@@ -523,6 +713,9 @@ void webserver_start() {
         }
     });
 
+    const char* headers[] = { "If-None-Match" };
+    webserver.collectHeaders(headers, 1);
+    bootTag = esp_random();
     webserver.begin();
     Serial.print(millis());
     Serial.println(F(": Webserver started."));
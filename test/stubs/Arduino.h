@@ -0,0 +1,90 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// Arduino core stand-in for the host build (env:native), only what
+// the natively built modules use; millis() and delay() run on the
+// virtual clock of the host HAL (src/hal.cpp)
+
+#ifndef _ARDUINO_STUB_H
+#define _ARDUINO_STUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x03
+
+#define F(s) (s)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+unsigned long millis();
+void delay(uint32_t ms);
+
+inline long map(long x, long in_min, long in_max, long out_min, long out_max) {
+    return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+class String : public std::string {
+public:
+    String(const char* s = "") : std::string(s) {}
+    const char* c_str() const { return std::string::c_str(); }
+};
+
+// console output is dropped unless SERIAL_STDOUT is defined
+class HardwareSerial {
+public:
+    int printf(const char* fmt, ...) {
+#ifdef SERIAL_STDOUT
+        va_list args;
+        va_start(args, fmt);
+        int n = vprintf(fmt, args);
+        va_end(args);
+        return n;
+#else
+        return 0;
+#endif
+    }
+    void print(const char* s) { printf("%s", s); }
+    void print(unsigned long n) { printf("%lu", n); }
+    void println(const char* s = "") { printf("%s\n", s); }
+    void println(unsigned long n) { printf("%lu\n", n); }
+};
+
+inline HardwareSerial Serial;
+
+#endif
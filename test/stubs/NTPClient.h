@@ -0,0 +1,36 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _NTPCLIENT_STUB_H
+#define _NTPCLIENT_STUB_H
+
+#include <WiFiUdp.h>
+
+// host build never syncs, system time is set by halSetTime()
+class NTPClient {
+public:
+    NTPClient(WiFiUDP& udp, const char* server, long offset) {}
+    void begin() {}
+    void end() {}
+    bool forceUpdate() { return false; }
+    unsigned long getEpochTime() { return 0; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+#ifndef _PREFERENCES_STUB_H
+#define _PREFERENCES_STUB_H
+
+#include <Arduino.h>
+
+// empty NVS, host builds always run on the compiled in defaults
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false) { return true; }
+    void end() {}
+    bool getBool(const char* key, bool value = false) { return value; }
+    size_t putBool(const char* key, bool value) { return 1; }
+    size_t getBytesLength(const char* key) { return 0; }
+    size_t getBytes(const char* key, void* buf, size_t len) { return 0; }
+    size_t putBytes(const char* key, const void* buf, size_t len) { return len; }
+    bool clear() { return true; }
+};
+
+#endif
@@ -0,0 +1,124 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// host stand-in for JChristensen/Timezone, same DST rule
+// semantics so local program start times convert like on
+// the device
+
+#ifndef _TIMEZONE_STUB_H
+#define _TIMEZONE_STUB_H
+
+#include <Arduino.h>
+
+enum week_t { Last, First, Second, Third, Fourth };
+enum dow_t { Sun = 1, Mon, Tue, Wed, Thu, Fri, Sat };
+enum month_t { Jan = 1, Feb, Mar, Apr, May, Jun, Jul, Aug, Sep, Oct, Nov, Dec };
+
+typedef struct {
+    char abbrev[6];
+    uint8_t week;
+    uint8_t dow;
+    uint8_t month;
+    uint8_t hour;
+    int offset;  // minutes from UTC
+} TimeChangeRule;
+
+class Timezone {
+public:
+    Timezone(TimeChangeRule dstStart, TimeChangeRule stdStart) 
+        : dst(dstStart), std(stdStart), year(0) {}
+
+    time_t toLocal(time_t utc) {
+        return utc + (utcIsDST(utc) ? dst.offset : std.offset) * 60;
+    }
+
+    time_t toLocal(time_t utc, TimeChangeRule** tcr) {
+        bool isDST = utcIsDST(utc);
+        *tcr = isDST ? &dst : &std;
+        return utc + (*tcr)->offset * 60;
+    }
+
+    // ambiguous local times after the change back to standard
+    // time are taken as standard time, skipped ones as DST
+    time_t toUTC(time_t local) {
+        calcTimeChanges(yearOf(local));
+        return local - (locIsDST(local) ? dst.offset : std.offset) * 60;
+    }
+
+    bool utcIsDST(time_t utc) {
+        calcTimeChanges(yearOf(utc));
+        if (stdUTC > dstUTC)  // northern hemisphere
+            return utc >= dstUTC && utc < stdUTC;
+        return !(utc >= stdUTC && utc < dstUTC);
+    }
+
+    bool locIsDST(time_t local) {
+        calcTimeChanges(yearOf(local));
+        if (stdLoc > dstLoc)
+            return local >= dstLoc && local < stdLoc;
+        return !(local >= stdLoc && local < dstLoc);
+    }
+
+private:
+    TimeChangeRule dst, std;
+    int year;
+    time_t dstUTC, stdUTC, dstLoc, stdLoc;
+
+    static int yearOf(time_t t) {
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        return tm.tm_year + 1900;
+    }
+
+    // local time of the rule's change in the given year
+    static time_t toTime_t(const TimeChangeRule& r, int yr) {
+        struct tm tm = {};
+        int m = r.month, w = r.week;
+        if (w == Last) {  // first week of next month, back one week
+            if (++m > 12) {
+                m = 1;
+                yr++;
+            }
+            w = First;
+        }
+        tm.tm_year = yr - 1900;
+        tm.tm_mon = m - 1;
+        tm.tm_mday = 1;
+        tm.tm_hour = r.hour;
+        time_t t = timegm(&tm);
+        gmtime_r(&t, &tm);
+        t += (7 * (w - 1) + (r.dow - (tm.tm_wday + 1) + 7) % 7) * 86400L;
+        if (r.week == Last)
+            t -= 7 * 86400L;
+        return t;
+    }
+
+    void calcTimeChanges(int yr) {
+        if (yr == year)
+            return;
+        year = yr;
+        dstLoc = toTime_t(dst, yr);
+        stdLoc = toTime_t(std, yr);
+        dstUTC = dstLoc - std.offset * 60;
+        stdUTC = stdLoc - dst.offset * 60;
+    }
+};
+
+#endif
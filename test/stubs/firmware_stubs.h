@@ -0,0 +1,54 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// stand-ins for firmware modules left out of the host build
+// (logging, sensor task); include in exactly one source
+// file of each test suite
+
+#ifndef _FIRMWARE_STUBS_H
+#define _FIRMWARE_STUBS_H
+
+#include "sensors.h"
+#include "logging.h"
+
+// readings returned by sensorSnapshot(), set by the test
+sensorReadings_t stubReadings = { 20.0, 50, 50, { 0 }, { 0 }, 0 };
+
+uint32_t stubLogMsgs = 0;
+
+
+void logMsg(const char *msg) {
+    stubLogMsgs++;
+}
+
+
+sensorReadings_t sensorSnapshot() {
+    return stubReadings;
+}
+
+
+void sensorsActivity(bool active) {
+}
+
+
+void reportMoisture(bool verbose, bool log) {
+}
+
+#endif
@@ -0,0 +1,115 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// filter benchmarks on the host: cost of filterUpdate() per reading 
+// for every filter type and window size, results are printed in ns
+
+#include <unity.h>
+#include <chrono>
+#include "firmware_stubs.h"
+#include "filter.h"
+
+#define BENCH_READINGS 1000000
+
+static int16_t readings[1024];
+
+
+static uint64_t nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// noisy readings with spikes, see test_filter
+static void fillReadings() {
+    uint32_t rng = 2463534242UL;
+
+    for (uint16_t i = 0; i < 1024; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        readings[i] = 2000 + rng % 41 - 20 + ((rng >> 8) % 50 ? 0 : 600);
+    }
+}
+
+
+static void benchFilter(filtertype_t type) {
+    volatile int16_t sink = 0;
+    uint64_t t, ns;
+    char msg[64];
+    filter_t f;
+
+    for (uint8_t size = 3; size <= FILTER_MAX_SIZE; size += 2) {
+        filterInit(&f, type, size);
+        t = nanos();
+        for (uint32_t i = 0; i < BENCH_READINGS; i++)
+            sink = filterUpdate(&f, readings[i & 1023]);
+        ns = nanos() - t;
+        snprintf(msg, sizeof(msg), "%s, size %u: %.1f ns/reading", filterName(type), 
+            size, (double)ns / BENCH_READINGS);
+        TEST_MESSAGE(msg);
+    }
+    TEST_ASSERT_INT_WITHIN(700, 2000, sink);
+}
+
+
+void setUp() {
+    fillReadings();
+}
+
+
+void tearDown() {
+}
+
+
+void test_mean() {
+    benchFilter(FILTER_MEAN);
+}
+
+
+void test_median() {
+    benchFilter(FILTER_MEDIAN);
+}
+
+
+void test_trimmed() {
+    benchFilter(FILTER_TRIMMED);
+}
+
+
+void test_ema() {
+    benchFilter(FILTER_EMA);
+}
+
+
+void test_hampel() {
+    benchFilter(FILTER_HAMPEL);
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_mean);
+    RUN_TEST(test_median);
+    RUN_TEST(test_trimmed);
+    RUN_TEST(test_ema);
+    RUN_TEST(test_hampel);
+    return UNITY_END();
+}
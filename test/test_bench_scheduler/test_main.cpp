@@ -0,0 +1,226 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// scheduler benchmarks on the host: insert and dispatch cost with 16,
+// 256 and 4096 pending jobs and pulse watering with 1024 pending valve
+// events; run in env:native_bench (min-heap) and env:native_bench_wheel
+// (timing wheel) to compare both backends, results are printed in ns
+
+#include <unity.h>
+#include <chrono>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "scheduler.h"
+
+#if MAX_JOBS < 4096
+#error "scheduler benchmarks need -DMAX_JOBS=4096, see env:native_bench"
+#endif
+
+#define BENCH_SPAN_MS 600000  // deadlines within next 10 minutes
+#define BENCH_STEP_MS 1000  // scheduler pass once a second
+#define BENCH_JOBS_TOTAL 16384  // jobs per size, spread over several rounds
+
+#define PULSE_ZONES 32
+#define PULSE_CYCLES 16
+#define PULSE_ON_MS 10000
+#define PULSE_SOAK_MS 60000
+#define PULSE_STEP_MS 10  // scheduler pass every loop
+
+static uint32_t rng;
+static uint32_t dispatchedJobs;
+static uint64_t lastDeadline;
+static bool outOfOrder;
+
+
+// xorshift32, same sequence on every host
+static uint32_t rnd(uint32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+}
+
+
+static uint64_t nanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// job function, only checks that jobs are dispatched in time order
+static void dispatch(uint8_t relay, bool state) {
+    uint64_t now = getUptimeMillis();
+
+    if (now < lastDeadline)
+        outOfOrder = true;
+    lastDeadline = now;
+    dispatchedJobs++;
+}
+
+
+static void report(const char* name, uint16_t jobs, uint64_t ns, uint32_t ops, const char* unit) {
+    char msg[96];
+
+    snprintf(msg, sizeof(msg), "%s, %u jobs: %.1f ns/%s", name, jobs, (double)ns / ops, unit);
+    TEST_MESSAGE(msg);
+}
+
+
+// fill queue with given number of jobs, then run the virtual clock 
+// until all jobs have been dispatched (dispatch cost includes the
+// passes without due jobs); repeated to get stable numbers
+static void benchQueue(uint16_t jobs) {
+    uint32_t rounds = max(BENCH_JOBS_TOTAL / jobs, 4);
+    uint64_t insertNs = 0, dispatchNs = 0, t, now;
+
+    for (uint32_t r = 0; r < rounds; r++) {
+        now = getUptimeMillis();
+        t = nanos();
+        for (uint16_t i = 0; i < jobs; i++)
+            TEST_ASSERT_TRUE(schedule_job(now + 1 + rnd(BENCH_SPAN_MS), dispatch, 1, true, JOB_PROGRAM));
+        insertNs += nanos() - t;
+        TEST_ASSERT_EQUAL(jobs, jobs_pending());
+
+        dispatchedJobs = 0;
+        t = nanos();
+        for (uint32_t ms = 0; ms <= BENCH_SPAN_MS; ms += BENCH_STEP_MS) {
+            halAdvance(BENCH_STEP_MS);
+            scheduler();
+        }
+        dispatchNs += nanos() - t;
+        TEST_ASSERT_EQUAL(jobs, dispatchedJobs);
+        TEST_ASSERT_EQUAL(0, jobs_pending());
+    }
+    TEST_ASSERT_FALSE(outOfOrder);
+    report("insert", jobs, insertNs, rounds * jobs, "job");
+    report("dispatch", jobs, dispatchNs, rounds * jobs, "job");
+}
+
+
+void setUp() {
+    rng = 2463534242UL;
+    lastDeadline = 0;
+    outOfOrder = false;
+    memset(&schedulerStats, 0, sizeof(schedulerStats));
+    schedulerStats.minMillis = UINT32_MAX;
+}
+
+
+void tearDown() {
+}
+
+
+void test_queue_16() {
+    benchQueue(16);
+}
+
+
+void test_queue_256() {
+    benchQueue(256);
+}
+
+
+void test_queue_4096() {
+    benchQueue(4096);
+}
+
+
+// pulse watering on many zones: every zone is switched on and off
+// PULSE_CYCLES times with a soak time in between, all valve events
+// are scheduled in advance and dispatched by a scheduler pass per loop
+void test_pulse_watering() {
+    uint64_t start = getUptimeMillis() + 1000, end = 0, open, t, ns;
+    uint32_t events = 0, passes = 0;
+
+    t = nanos();
+    for (uint8_t z = 0; z < PULSE_ZONES; z++) {
+        for (uint8_t c = 0; c < PULSE_CYCLES; c++) {
+            open = start + z * 2000 + (uint64_t)c * (PULSE_ON_MS + PULSE_SOAK_MS);
+            TEST_ASSERT_TRUE(schedule_job(open, dispatch, z + 1, true, JOB_PROGRAM));
+            TEST_ASSERT_TRUE(schedule_job(open + PULSE_ON_MS, dispatch, z + 1, false, JOB_PROGRAM));
+            end = max(end, open + PULSE_ON_MS);
+            events += 2;
+        }
+    }
+    ns = nanos() - t;
+    TEST_ASSERT_GREATER_OR_EQUAL(1000, jobs_pending());
+    report("pulse insert", events, ns, events, "job");
+
+    dispatchedJobs = 0;
+    t = nanos();
+    while (getUptimeMillis() <= end) {
+        halAdvance(PULSE_STEP_MS);
+        scheduler();
+        passes++;
+    }
+    ns = nanos() - t;
+    TEST_ASSERT_EQUAL(events, dispatchedJobs);
+    TEST_ASSERT_FALSE(outOfOrder);
+    TEST_ASSERT_LESS_OR_EQUAL(PULSE_STEP_MS, schedulerStats.maxMillis);
+    report("pulse dispatch", events, ns, events, "job");
+    report("pulse dispatch", events, ns, passes, "pass");
+}
+
+
+// every zone cancels its next pulse and shifts the following ones,
+// e.g. after rain; rescheduling is O(log n) for the heap and O(1) 
+// for the wheel
+void test_pulse_reschedule() {
+    static jobhandle_t handles[PULSE_ZONES * PULSE_CYCLES];
+    uint64_t start = getUptimeMillis() + 1000, t, ns;
+    uint16_t n = 0;
+
+    for (uint8_t z = 0; z < PULSE_ZONES; z++)
+        for (uint8_t c = 0; c < PULSE_CYCLES; c++)
+            handles[n++] = schedule_job(start + z * 2000 + (uint64_t)c * (PULSE_ON_MS + PULSE_SOAK_MS), 
+                dispatch, z + 1, true, JOB_PROGRAM);
+
+    t = nanos();
+    for (uint16_t i = 0; i < n; i++) {
+        if (i % PULSE_CYCLES)
+            TEST_ASSERT_TRUE(reschedule_job(handles[i], start + 3600000 + rnd(BENCH_SPAN_MS)));
+        else
+            TEST_ASSERT_TRUE(cancel_job(handles[i]));
+    }
+    ns = nanos() - t;
+    TEST_ASSERT_EQUAL(n - PULSE_ZONES, jobs_pending());
+    report("pulse reschedule", n, ns, n, "job");
+
+    dispatchedJobs = 0;
+    while (jobs_pending()) {
+        halAdvance(BENCH_STEP_MS);
+        scheduler();
+    }
+    TEST_ASSERT_EQUAL(n - PULSE_ZONES, dispatchedJobs);
+    TEST_ASSERT_FALSE(outOfOrder);
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_queue_16);
+    RUN_TEST(test_queue_256);
+    RUN_TEST(test_queue_4096);
+    RUN_TEST(test_pulse_watering);
+    RUN_TEST(test_pulse_reschedule);
+    return UNITY_END();
+}
@@ -0,0 +1,187 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// runs currentDetect() against synthetic pump current traces sampled
+// every PUMP_CURRENT_SAMPLE_MS: start-up inrush, noisy normal operation,
+// dry run, clogged line, stall and short spikes
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "currentdetect.h"
+
+#define NORMAL_MA 1000
+#define TRACE_MS 10000
+
+static const currentLimits_t limits = {
+    PUMP_CURRENT_DRY_MA,
+    PUMP_CURRENT_CLOG_MA,
+    PUMP_CURRENT_STALL_MA,
+    PUMP_CURRENT_NONE_MA,
+    PUMP_CURRENT_STARTUP_MS,
+    PUMP_CURRENT_FAULT_MS,
+    PUMP_CURRENT_STALL_MS
+};
+
+// trace segment, current ramps linearly from fromMA to toMA
+typedef struct {
+    uint32_t ms;
+    uint16_t fromMA;
+    uint16_t toMA;
+} segment_t;
+
+static uint32_t rng;
+static uint32_t detectedAt;  // ms since start of trace
+
+
+static int16_t noise(uint16_t amplitude) {
+    if (!amplitude)
+        return 0;
+    rng = rng * 1103515245 + 12345;
+    return (int16_t)((rng >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+
+// feed trace to fresh detector, returns first fault (or CURRENT_OK)
+static currentfault_t runTrace(const segment_t* trace, uint8_t n, uint16_t noiseMA) {
+    currentDetector_t d;
+    currentfault_t fault;
+    uint32_t t = 0;
+    int32_t mA;
+
+    rng = 1;
+    currentReset(&d, &limits);
+    for (uint8_t s = 0; s < n; s++) {
+        for (uint32_t ms = 0; ms < trace[s].ms; ms += PUMP_CURRENT_SAMPLE_MS) {
+            mA = trace[s].fromMA + ((int32_t)trace[s].toMA - trace[s].fromMA) * (int32_t)ms / (int32_t)trace[s].ms;
+            mA += noise(noiseMA);
+            fault = currentDetect(&d, mA < 0 ? 0 : mA, t ? PUMP_CURRENT_SAMPLE_MS : 0);
+            t += PUMP_CURRENT_SAMPLE_MS;
+            if (fault != CURRENT_OK) {
+                detectedAt = t;
+                return fault;
+            }
+        }
+    }
+    detectedAt = 0;
+    return CURRENT_OK;
+}
+
+
+void setUp() {
+}
+
+
+void tearDown() {
+}
+
+
+void test_normal_run() {
+    const segment_t trace[] = {
+        { 300, 4000, 4000 },  // inrush, above stall level
+        { 200, 4000, NORMAL_MA },
+        { TRACE_MS, NORMAL_MA, NORMAL_MA }
+    };
+
+    TEST_ASSERT_EQUAL(CURRENT_OK, runTrace(trace, 3, 0));
+    TEST_ASSERT_EQUAL(CURRENT_OK, runTrace(trace, 3, 300));  // noisy sensor
+}
+
+
+void test_dry_run() {
+    const segment_t trace[] = {
+        { 2000, NORMAL_MA, NORMAL_MA },
+        { 500, NORMAL_MA, 400 },  // reservoir ran empty
+        { TRACE_MS, 400, 400 }
+    };
+
+    TEST_ASSERT_EQUAL(CURRENT_DRY, runTrace(trace, 3, 100));
+    TEST_ASSERT_GREATER_OR_EQUAL(2000 + PUMP_CURRENT_FAULT_MS, detectedAt);
+    TEST_ASSERT_LESS_OR_EQUAL(2500 + PUMP_CURRENT_FAULT_MS + 500, detectedAt);
+}
+
+
+void test_clogged_line() {
+    const segment_t trace[] = {
+        { 2000, NORMAL_MA, NORMAL_MA },
+        { 1000, NORMAL_MA, 2200 },
+        { TRACE_MS, 2200, 2200 }
+    };
+
+    TEST_ASSERT_EQUAL(CURRENT_CLOG, runTrace(trace, 3, 100));
+    TEST_ASSERT_LESS_OR_EQUAL(3000 + PUMP_CURRENT_FAULT_MS + 500, detectedAt);
+}
+
+
+void test_stall() {
+    const segment_t locked[] = {
+        { TRACE_MS, 4000, 4000 }  // rotor never starts turning
+    };
+    const segment_t none[] = {
+        { TRACE_MS, 0, 0 }  // broken wire or relay
+    };
+
+    TEST_ASSERT_EQUAL(CURRENT_STALL, runTrace(locked, 1, 0));
+    TEST_ASSERT_LESS_OR_EQUAL(PUMP_CURRENT_STARTUP_MS + PUMP_CURRENT_STALL_MS + 100, detectedAt);
+    TEST_ASSERT_EQUAL(CURRENT_STALL, runTrace(none, 1, 0));
+    TEST_ASSERT_LESS_OR_EQUAL(PUMP_CURRENT_STARTUP_MS + PUMP_CURRENT_STALL_MS + 100, detectedAt);
+}
+
+
+void test_short_spikes_ignored() {
+    const segment_t trace[] = {
+        { 2000, NORMAL_MA, NORMAL_MA },
+        { 100, 2500, 2500 },  // valve switching
+        { 2000, NORMAL_MA, NORMAL_MA },
+        { 100, 300, 300 },  // air bubble
+        { TRACE_MS, NORMAL_MA, NORMAL_MA }
+    };
+
+    TEST_ASSERT_EQUAL(CURRENT_OK, runTrace(trace, 5, 0));
+}
+
+
+// ADC zero and steps refer to PUMP_CURRENT_ADC_BITS, a reading 
+// at another resolution would look like a stalled pump
+void test_adc_conversion() {
+    uint16_t steps = 1000000UL / PUMP_CURRENT_UA_PER_STEP;  // ~1 A
+
+    TEST_ASSERT_EQUAL(12, PUMP_CURRENT_ADC_BITS);
+    TEST_ASSERT_EQUAL(0, currentFromADC(PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_UA_PER_STEP));
+    TEST_ASSERT_INT_WITHIN(5, 1000, currentFromADC(PUMP_CURRENT_ADC_ZERO + steps, 
+        PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_UA_PER_STEP));
+    TEST_ASSERT_INT_WITHIN(5, 1000, currentFromADC(PUMP_CURRENT_ADC_ZERO - steps, 
+        PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_UA_PER_STEP));
+    TEST_ASSERT_GREATER_OR_EQUAL(PUMP_CURRENT_STALL_MA, currentFromADC(PUMP_CURRENT_ADC_ZERO >> 2, 
+        PUMP_CURRENT_ADC_ZERO, PUMP_CURRENT_UA_PER_STEP));  // 10 bit reading
+    TEST_ASSERT_EQUAL(0xFFFF, currentFromADC(100000, 0, 0xFFFF));
+}
+
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_normal_run);
+    RUN_TEST(test_dry_run);
+    RUN_TEST(test_clogged_line);
+    RUN_TEST(test_stall);
+    RUN_TEST(test_short_spikes_ignored);
+    RUN_TEST(test_adc_conversion);
+    return UNITY_END();
+}
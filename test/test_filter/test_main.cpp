@@ -0,0 +1,227 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// sensor filters: results compared to straightforward reference
+// implementations and to the true values of sensor traces with
+// noise, spikes and missing echoes as seen on the controller
+
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "firmware_stubs.h"
+#include "filter.h"
+
+#define TRACE_LENGTH 2000
+
+typedef struct {
+    int16_t truth[TRACE_LENGTH];
+    int16_t reading[TRACE_LENGTH];
+} trace_t;
+
+static trace_t moisture, level;
+static uint32_t rng;
+
+
+// xorshift32, same sequence on every host
+static uint32_t rnd(uint32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+}
+
+
+// capacitive sensor (raw ADC): soil dries slowly, watering every 500 
+// readings, +-20 noise and single spikes when the radio transmits
+static void moistureTrace(trace_t* t) {
+    int32_t value = 2400;
+
+    for (uint16_t i = 0; i < TRACE_LENGTH; i++) {
+        if (i % 500 == 250)
+            value = 1700;
+        else if (i % 4 == 0)
+            value++;
+        t->truth[i] = value;
+        t->reading[i] = value + rnd(41) - 20;
+        if (!rnd(50))
+            t->reading[i] += rnd(2) ? 600 : -600;
+    }
+}
+
+
+// ultrasonic distance (cm): reservoir is pumped down slowly, +-1 cm 
+// noise, missing echoes (0) and echoes from the reservoir wall
+static void levelTrace(trace_t* t) {
+    for (uint16_t i = 0; i < TRACE_LENGTH; i++) {
+        t->truth[i] = 30 + i / 40;
+        t->reading[i] = t->truth[i] + rnd(3) - 1;
+        if (!rnd(15))
+            t->reading[i] = rnd(2) ? 0 : t->truth[i] + 80;
+    }
+}
+
+
+// same filters computed from scratch for every reading
+static int16_t reference(filtertype_t type, const std::vector<int16_t>& window, int16_t reading) {
+    std::vector<int32_t> s(window.begin(), window.end()), dev;
+    int32_t n = s.size(), sum = 0, med, mad, trim = n / 4;
+
+    std::sort(s.begin(), s.end());
+    for (int32_t v : s)
+        sum += v;
+    med = (n & 1) ? s[n/2] : (s[n/2 - 1] + s[n/2]) / 2;
+
+    switch (type) {
+        case FILTER_MEAN:
+            return sum / n;
+        case FILTER_MEDIAN:
+            return med;
+        case FILTER_TRIMMED:
+            sum = 0;
+            for (int32_t i = trim; i < n - trim; i++)
+                sum += s[i];
+            return sum / (n - 2 * trim);
+        case FILTER_HAMPEL:
+            if (n < 3)
+                return reading;
+            for (int32_t v : s)
+                dev.push_back(abs(v - med));
+            std::sort(dev.begin(), dev.end());
+            mad = (n & 1) ? dev[n/2] : (dev[n/2 - 1] + dev[n/2]) / 2;
+            return (abs(reading - med) > 3 * 1.4826 * std::max(mad, 1)) ? med : reading;
+        default:
+            return reading;
+    }
+}
+
+
+// run trace through filter, returns given percentile of absolute 
+// errors against true values, step responses are not counted
+static int32_t error(const trace_t* t, filtertype_t type, uint8_t size, uint8_t percentile) {
+    std::vector<int32_t> err;
+    filter_t f;
+    int16_t out;
+
+    filterInit(&f, type, size);
+    for (uint16_t i = 0; i < TRACE_LENGTH; i++) {
+        out = filterUpdate(&f, t->reading[i]);
+        if (i >= size && (i % 500) >= 250 + size)
+            err.push_back(abs(out - t->truth[i]));
+    }
+    std::sort(err.begin(), err.end());
+    return err[(err.size() - 1) * percentile / 100];
+}
+
+
+void setUp() {
+    rng = 2463534242UL;
+    moistureTrace(&moisture);
+    levelTrace(&level);
+}
+
+
+void tearDown() {
+}
+
+
+void test_window_filters_match_reference() {
+    const filtertype_t types[] = { FILTER_MEAN, FILTER_MEDIAN, FILTER_TRIMMED, FILTER_HAMPEL };
+    const trace_t* traces[] = { &moisture, &level };
+    std::vector<int16_t> window;
+    filter_t f;
+
+    for (const trace_t* t : traces) {
+        for (filtertype_t type : types) {
+            for (uint8_t size = 1; size <= FILTER_MAX_SIZE; size++) {
+                filterInit(&f, type, size);
+                window.clear();
+                for (uint16_t i = 0; i < TRACE_LENGTH; i++) {
+                    window.push_back(t->reading[i]);
+                    if (window.size() > size)
+                        window.erase(window.begin());
+                    TEST_ASSERT_EQUAL_INT16(reference(type, window, t->reading[i]), 
+                        filterUpdate(&f, t->reading[i]));
+                }
+            }
+        }
+    }
+}
+
+
+// fixed-point smoothing stays within one step of floating point
+void test_ema_matches_reference() {
+    filter_t f;
+    double ema = 0, alpha;
+    uint8_t shift;
+
+    for (uint8_t size = 1; size <= FILTER_MAX_SIZE; size++) {
+        for (shift = 0; (2 << shift) < size + 1; shift++);
+        alpha = 1.0 / (1 << shift);
+        filterInit(&f, FILTER_EMA, size);
+        for (uint16_t i = 0; i < TRACE_LENGTH; i++) {
+            ema = i ? ema + alpha * (moisture.reading[i] - ema) : moisture.reading[i];
+            TEST_ASSERT_INT_WITHIN(1, (int32_t)(ema + 0.5), filterUpdate(&f, moisture.reading[i]));
+        }
+    }
+}
+
+
+// median based filters remove spikes in 99% of the readings (two
+// spikes in one window may pass), averages are pulled away
+void test_moisture_trace_accuracy() {
+    TEST_ASSERT_LESS_OR_EQUAL(20, error(&moisture, FILTER_MEDIAN, 5, 99));
+    TEST_ASSERT_LESS_OR_EQUAL(20, error(&moisture, FILTER_HAMPEL, 5, 99));
+    TEST_ASSERT_LESS_OR_EQUAL(20, error(&moisture, FILTER_TRIMMED, 5, 99));
+    TEST_ASSERT_GREATER_THAN(100, error(&moisture, FILTER_MEAN, 5, 99));
+    TEST_ASSERT_GREATER_THAN(100, error(&moisture, FILTER_EMA, 5, 99));
+}
+
+
+// default filter for water level (see config.h) hides missing echoes,
+// the trimmed mean of five readings would only drop one of them
+void test_level_trace_accuracy() {
+    TEST_ASSERT_LESS_OR_EQUAL(2, error(&level, FILTER_MEDIAN, 5, 99));
+    TEST_ASSERT_LESS_OR_EQUAL(2, error(&level, FILTER_HAMPEL, 5, 99));
+    TEST_ASSERT_GREATER_THAN(10, error(&level, FILTER_MEAN, 5, 99));
+}
+
+
+// filtered value follows a watering within half a window
+void test_step_response() {
+    filter_t f;
+    uint16_t i;
+
+    filterInit(&f, FILTER_MEDIAN, 5);
+    for (i = 0; i < 10; i++)
+        filterUpdate(&f, 2400);
+    for (i = 1; filterUpdate(&f, 1700) != 1700; i++);
+    TEST_ASSERT_EQUAL(3, i);
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_window_filters_match_reference);
+    RUN_TEST(test_ema_matches_reference);
+    RUN_TEST(test_moisture_trace_accuracy);
+    RUN_TEST(test_level_trace_accuracy);
+    RUN_TEST(test_step_response);
+    return UNITY_END();
+}
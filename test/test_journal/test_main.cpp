@@ -0,0 +1,109 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// reset journal: valve runs interrupted by a reset are resumed for
+// their remaining time if the system was down only briefly
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "relay.h"
+#include "scheduler.h"
+#include "journal.h"
+
+#define RUN_MS 1200000  // 20 minute valve run
+#define RESET_AFTER_MS 180000
+
+
+static void mainLoop(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 100) {
+        halAdvance(100);
+        scheduler();
+        logRelayEvents();
+        journalSync();
+    }
+}
+
+
+// starts valve run and simulates a reset a few minutes into it,
+// journal only changed when the valve was opened
+static void resetDuringRun(uint32_t downMillis) {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 100, setRelay, 1, true, JOB_PROGRAM);
+    schedule_job(now + 100 + RUN_MS, setRelay, 1, false, JOB_PROGRAM);
+    mainLoop(RESET_AFTER_MS);
+    TEST_ASSERT_EQUAL(1UL << 1, relaysOpen());
+
+    preempt_jobs(JOB_SAFETY, 0);
+    initRelays();
+    halAdvance(downMillis);
+    journalRecover(WATCHDOG);
+}
+
+
+void setUp() {
+    halSetTime(1767225600);
+    stubReadings.waterLevel = 20;
+    switchesPrefs.pumpAutoStopSecs = 3600;
+    switchesPrefs.relaysBlockMins = 0;
+    initRelays();
+    preempt_jobs(JOB_SAFETY, 0);
+    mainLoop(1000);
+}
+
+
+void tearDown() {
+}
+
+
+void test_resume_remaining_run() {
+    valvejob_t job;
+    uint64_t now;
+
+    resetDuringRun(30000);
+    now = getUptimeMillis();
+    TEST_ASSERT_EQUAL(2, jobs_pending());
+    job.time = 0;
+    job.seq = 0;
+    TEST_ASSERT_TRUE(jobs_next(&job));
+    TEST_ASSERT_TRUE(job.state);
+    TEST_ASSERT_EQUAL(now, job.time);
+    TEST_ASSERT_TRUE(jobs_next(&job));
+    TEST_ASSERT_FALSE(job.state);
+    TEST_ASSERT_INT_WITHIN(1100, now + RUN_MS - RESET_AFTER_MS - 30000, job.time);
+}
+
+
+void test_drop_after_long_downtime() {
+    resetDuringRun((JOURNAL_RESUME_SECS + 5) * 1000);
+    TEST_ASSERT_EQUAL(0, jobs_pending());
+}
+
+
+int main() {
+    initPrefs();  // valve defaults from config.h
+    UNITY_BEGIN();
+    RUN_TEST(test_resume_remaining_run);
+    RUN_TEST(test_drop_after_long_downtime);
+    return UNITY_END();
+}
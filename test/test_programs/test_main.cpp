@@ -0,0 +1,76 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// irrigation programs: conflict check
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "prefs.h"
+#include "programs.h"
+
+
+// all programs run all valves longer than the pump auto stop at 
+// four close start times, so most valve runs conflict
+static void conflictingPrograms() {
+    irrigationProgram_t* p;
+
+    for (uint8_t i = 0; i < MAX_PROGRAMS; i++) {
+        p = &switchesPrefs.irrigationPrograms[i];
+        p->enabled = true;
+        p->weekdays = 0x7F;
+        for (uint8_t j = 0; j < MAX_PROGRAM_STARTS; j++)
+            p->starts[j] = 6 * 60 + i * 7 + j * 2;
+        for (uint8_t j = 0; j < NUM_RELAY; j++)
+            p->secs[j] = switchesPrefs.pumpAutoStopSecs + 60;
+    }
+    switchesPrefs.autoIrrigationPauseHours = 0;
+}
+
+
+void setUp() {
+    conflictingPrograms();
+}
+
+
+void tearDown() {
+}
+
+
+// conflicts beyond the array are reported as max + 1, no matter
+// how often they recur on other weekdays
+void test_conflicts_bounded() {
+    static programConflict_t conflicts[UINT8_MAX];
+    uint8_t n;
+
+    TEST_ASSERT_EQUAL(MAX_CONFLICTS + 1, checkPrograms(conflicts, MAX_CONFLICTS));
+    TEST_ASSERT_EQUAL(3, checkPrograms(conflicts, 2));
+    n = checkPrograms(conflicts, UINT8_MAX);
+    TEST_ASSERT_GREATER_THAN(MAX_CONFLICTS, n);
+    TEST_ASSERT_LESS_THAN(UINT8_MAX, n);
+}
+
+
+int main() {
+    initPrefs();  // valve defaults from config.h
+    UNITY_BEGIN();
+    RUN_TEST(test_conflicts_bounded);
+    return UNITY_END();
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// pump current monitor during zone handover: the pump keeps running
+// against closed valves for up to PUMP_HANDOVER_SECS, the higher
+// current of dead-heading must not lock out the pump; needs
+// PUMP_CURRENT_PIN and PUMP_HANDOVER_SECS (pio test -e native_pump)
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "relay.h"
+#include "scheduler.h"
+
+#if !defined(PUMP_CURRENT_PIN) || PUMP_HANDOVER_SECS <= ZONE_GAP_SECS
+#error "needs PUMP_CURRENT_PIN and PUMP_HANDOVER_SECS > ZONE_GAP_SECS"
+#endif
+
+#define RUN_MS 20000
+#define NORMAL_MA 1000
+#define DEADHEAD_MA 1800  // above PUMP_CURRENT_CLOG_MA
+
+static bool lockedOut;
+
+
+// main loop with pump current depending on open valves
+static void mainLoop(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += PUMP_CURRENT_SAMPLE_MS) {
+        halAdvance(PUMP_CURRENT_SAMPLE_MS);
+        if (relaystate[0] == RELAY_ON)
+            stubReadings.pumpCurrent = relaysOpen() ? NORMAL_MA : DEADHEAD_MA;
+        else
+            stubReadings.pumpCurrent = 0;
+        pumpMonitor();
+        relayCommands();
+        scheduler();
+        logRelayEvents();
+        if (relaystate[0] == RELAY_LOCKED)
+            lockedOut = true;
+    }
+}
+
+
+void setUp() {
+    halSetTime(1767225600);
+    stubReadings.waterLevel = 20;
+    switchesPrefs.pumpAutoStopSecs = 3600;
+    switchesPrefs.relaysBlockMins = 0;
+    initRelays();
+    preempt_jobs(JOB_SAFETY, 0);
+    lockedOut = false;
+}
+
+
+void tearDown() {
+}
+
+
+// two zones with a gap, pump is dead-headed in between
+void test_handover_not_locked_out() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 100, setRelay, 1, true, JOB_PROGRAM);
+    schedule_job(now + 100 + RUN_MS, setRelay, 1, false, JOB_PROGRAM);
+    now += 100 + RUN_MS + ZONE_GAP_SECS * 1000;
+    schedule_job(now, setRelay, 2, true, JOB_PROGRAM);
+    schedule_job(now + RUN_MS, setRelay, 2, false, JOB_PROGRAM);
+
+    mainLoop(100 + RUN_MS + ZONE_GAP_SECS * 500);
+    TEST_ASSERT_EQUAL(0, relaysOpen());
+    TEST_ASSERT_EQUAL(RELAY_ON, relaystate[0]);  // handover
+    TEST_ASSERT_EQUAL(DEADHEAD_MA, stubReadings.pumpCurrent);
+
+    mainLoop(ZONE_GAP_SECS * 500 + RUN_MS / 2);
+    TEST_ASSERT_EQUAL(RELAY_ON, relaystate[2]);
+    mainLoop(RUN_MS / 2 + PUMP_HANDOVER_SECS * 1000 + 1000);
+    TEST_ASSERT_EQUAL(RELAY_OFF, relaystate[0]);
+    TEST_ASSERT_FALSE(lockedOut);
+}
+
+
+// same current with a valve open is a clogged line
+void test_clog_with_open_valve() {
+    setRelay(3, true);  // valves 1, 2 still blocked
+    TEST_ASSERT_EQUAL(RELAY_ON, relaystate[0]);
+    stubReadings.pumpCurrent = DEADHEAD_MA;
+    for (uint32_t t = 0; t < 3000 && relaystate[0] == RELAY_ON; t += PUMP_CURRENT_SAMPLE_MS) {
+        halAdvance(PUMP_CURRENT_SAMPLE_MS);
+        pumpMonitor();
+    }
+    TEST_ASSERT_EQUAL(RELAY_LOCKED, relaystate[0]);
+    TEST_ASSERT_EQUAL(0, relaysOpen());
+}
+
+
+int main() {
+    initPrefs();  // valve defaults from config.h
+    UNITY_BEGIN();
+    RUN_TEST(test_handover_not_locked_out);
+    RUN_TEST(test_clog_with_open_valve);
+    return UNITY_END();
+}
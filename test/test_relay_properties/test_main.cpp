@@ -0,0 +1,224 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// drives random sequences of valve commands, scheduled jobs, water
+// level readings and clock steps (incl. NTP adjustments) through the
+// relay module and checks its interlocks after every step; the system
+// time only steps forward since blocking is measured in local time
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "relay.h"
+#include "scheduler.h"
+
+#define PROPERTY_STEPS 200000
+#define PROPERTY_SEEDS 4
+
+static uint32_t rng;
+
+
+// xorshift32, same sequence on every host
+static uint32_t rnd(uint32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng % n;
+}
+
+
+static void randomStep() {
+    uint32_t r = rnd(100);
+    uint8_t num = rnd(NUM_RELAY + 1);
+
+    if (r < 20) {
+        setRelay(num, rnd(2));
+    } else if (r < 35) {
+        requestRelay(num, rnd(2));
+    } else if (r < 45) {
+        schedule_job(getUptimeMillis() + rnd(120000), setRelay, num, rnd(2), 
+            (jobprio_t)(JOB_MANUAL + rnd(3)));
+    } else if (r < 50) {
+        if (rnd(8))
+            stubReadings.waterLevel = 20;
+        else
+            stubReadings.waterLevel = rnd(2) ? -1 : 2;  // sensor error, low level
+    } else if (r < 75) {
+        halAdvance(rnd(2000));
+        if (!rnd(20))
+            halAdvance(1000 * rnd(120));
+        if (!rnd(200))
+            halSetTime(getUTCTime() + rnd(3600));  // NTP adjustment
+    } else if (r < 85) {
+        unblockRelays();
+        pumpAutoStop();
+    } else if (r < 95) {
+        relayCommands();
+    } else {
+        scheduler();
+        logRelayEvents();
+    }
+}
+
+
+// close everything and let blocked valves expire, pending
+// commands are carried out first to not open valves later
+static void settle() {
+    preempt_jobs(JOB_SAFETY, 0);
+    halAdvance(RELAY_COMMAND_WINDOW_MS + RELAY_MIN_ON_MS);
+    relayCommands();
+    for (uint8_t i = NUM_RELAY; i > 0; i--)
+        setRelay(i, false);
+    stubReadings.waterLevel = 20;
+    halAdvance(switchesPrefs.relaysBlockMins * 60000UL + 1000);
+    pumpAutoStop();
+    unblockRelays();
+    relayCommands();
+}
+
+
+static void runProperties(uint16_t pumpCapacity) {
+    char msg[48];
+
+    for (uint32_t seed = 1; seed <= PROPERTY_SEEDS; seed++) {
+        settle();
+        rng = seed * 2654435761UL;
+        switchesPrefs.pumpCapacity = pumpCapacity;
+        for (uint8_t i = 0; i < NUM_RELAY; i++)
+            switchesPrefs.flowRelay[i] = rnd(3) ? 5 + rnd(10) : 0;
+
+        for (uint32_t step = 0; step < PROPERTY_STEPS; step++) {
+            randomStep();
+            if (!checkInterlocks()) {
+                snprintf(msg, sizeof(msg), "seed %lu, step %lu", (unsigned long)seed, (unsigned long)step);
+                TEST_FAIL_MESSAGE(msg);
+            }
+        }
+    }
+}
+
+
+void setUp() {
+}
+
+
+void tearDown() {
+}
+
+
+void test_one_valve_at_a_time() {
+    runProperties(0);
+}
+
+
+void test_pump_capacity() {
+    runProperties(20);
+}
+
+
+// a manual command preempts programs once it is carried out,
+// not while it can still be cancelled out within its window
+void test_manual_override() {
+    uint64_t now;
+
+    settle();
+    now = getUptimeMillis();
+    schedule_job(now + 600000, setRelay, 2, true, JOB_PROGRAM);
+    schedule_job(now + 660000, setRelay, 2, false, JOB_PROGRAM);
+
+    requestRelay(1, true);
+    requestRelay(1, false);
+    halAdvance(RELAY_COMMAND_WINDOW_MS);
+    relayCommands();
+    TEST_ASSERT_EQUAL(2, jobs_pending());
+
+    requestRelay(1, true);
+    relayCommands();
+    TEST_ASSERT_EQUAL(2, jobs_pending());
+    halAdvance(RELAY_COMMAND_WINDOW_MS);
+    relayCommands();
+    TEST_ASSERT_EQUAL(RELAY_ON, relaystate[1]);
+    TEST_ASSERT_FALSE(jobs_scheduled());
+}
+
+
+// relay changes are published once by main loop, not while logging,
+// and once more after a failed publish
+void test_publish_due() {
+    settle();
+    logRelayEvents();
+    relayPublishDue();
+    setRelay(1, true);
+    TEST_ASSERT_FALSE(relayPublishDue());
+    logRelayEvents();
+    TEST_ASSERT_TRUE(relayPublishDue());
+    TEST_ASSERT_FALSE(relayPublishDue());
+    relayPublishRetry();  // publish failed
+    TEST_ASSERT_TRUE(relayPublishDue());
+    TEST_ASSERT_FALSE(relayPublishDue());
+    setRelay(1, false);
+}
+
+
+// a queued command is reported as commanded right away, so that
+// web ui switches don't snap back before it is carried out
+void test_status_pending() {
+    uint32_t version;
+
+    settle();
+    version = relayVersion();
+    requestRelay(1, true);
+    TEST_ASSERT_TRUE(relayVersion() != version);
+    TEST_ASSERT_TRUE(strstr(relayStatus(NULL), "\"valve1\":1") != NULL);
+    TEST_ASSERT_EQUAL(RELAY_OFF, relaystate[1]);
+
+    version = relayVersion();
+    requestRelay(1, false);  // cancelled out within window
+    TEST_ASSERT_TRUE(relayVersion() != version);
+    TEST_ASSERT_TRUE(strstr(relayStatus(NULL), "\"valve1\":0") != NULL);
+
+    requestRelay(1, true);
+    halAdvance(RELAY_COMMAND_WINDOW_MS);
+    relayCommands();
+    TEST_ASSERT_EQUAL(RELAY_ON, relaystate[1]);
+    TEST_ASSERT_TRUE(strstr(relayStatus(NULL), "\"valve1\":1") != NULL);
+    setRelay(1, false);
+}
+
+
+int main(int argc, char** argv) {
+    initPrefs();  // valve defaults from config.h
+    halSetTime(1782864000);  // 01/07/2026
+    switchesPrefs.pumpAutoStopSecs = 90;
+    switchesPrefs.relaysBlockMins = 1;
+    switchesPrefs.minWaterLevel = 4;
+    switchesPrefs.ignoreWaterLevel = false;
+    initRelays();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_one_valve_at_a_time);
+    RUN_TEST(test_pump_capacity);
+    RUN_TEST(test_manual_override);
+    RUN_TEST(test_publish_due);
+    RUN_TEST(test_status_pending);
+    return UNITY_END();
+}
@@ -0,0 +1,220 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// job scheduler: ordering, handles, preemption by priority class
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "scheduler.h"
+
+typedef struct {
+    uint64_t time;
+    uint8_t relay;
+    bool state;
+} dispatched_t;
+
+static dispatched_t dispatched[64];
+static uint16_t numDispatched;
+
+
+static void record(uint8_t relay, bool state) {
+    if (numDispatched < 64) {
+        dispatched[numDispatched].time = getUptimeMillis();
+        dispatched[numDispatched].relay = relay;
+        dispatched[numDispatched].state = state;
+    }
+    numDispatched++;
+}
+
+
+// advance virtual clock in steps of given ms, running the scheduler
+static void runFor(uint32_t ms, uint32_t step) {
+    for (uint32_t t = 0; t < ms; t += step) {
+        halAdvance(step);
+        scheduler();
+    }
+}
+
+
+void setUp() {
+    preempt_jobs(JOB_SAFETY, 0);
+    runFor(1000, 1000);  // drops stale jobs
+    numDispatched = 0;
+}
+
+
+void tearDown() {
+}
+
+
+void test_deadline_order() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 3000, record, 3, true, JOB_PROGRAM);
+    schedule_job(now + 1000, record, 1, true, JOB_PROGRAM);
+    schedule_job(now + 2000, record, 2, true, JOB_MANUAL);
+    schedule_job(now + 2000, record, 4, true, JOB_PROGRAM);  // same deadline, FIFO
+    TEST_ASSERT_EQUAL(4, jobs_pending());
+
+    runFor(4000, 10);
+    TEST_ASSERT_EQUAL(4, numDispatched);
+    TEST_ASSERT_EQUAL(1, dispatched[0].relay);
+    TEST_ASSERT_EQUAL(2, dispatched[1].relay);
+    TEST_ASSERT_EQUAL(4, dispatched[2].relay);
+    TEST_ASSERT_EQUAL(3, dispatched[3].relay);
+    TEST_ASSERT_EQUAL(now + 2000, dispatched[1].time);
+    TEST_ASSERT_FALSE(jobs_scheduled());
+}
+
+
+void test_stale_handles() {
+    uint64_t now = getUptimeMillis();
+    jobhandle_t job;
+
+    job = schedule_job(now + 1000, record, 1, true, JOB_PROGRAM);
+    TEST_ASSERT_TRUE(reschedule_job(job, now + 500));
+    TEST_ASSERT_TRUE(cancel_job(job));
+    TEST_ASSERT_FALSE(cancel_job(job));
+    TEST_ASSERT_FALSE(reschedule_job(job, now + 2000));
+    schedule_job(now + 1000, record, 2, true, JOB_PROGRAM);  // reuses slot
+    TEST_ASSERT_FALSE(cancel_job(job));
+    runFor(2000, 100);
+    TEST_ASSERT_EQUAL(1, numDispatched);
+    TEST_ASSERT_EQUAL(2, dispatched[0].relay);
+}
+
+
+void test_preempt_lower_classes() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 1000, record, 1, true, JOB_MANUAL);
+    schedule_job(now + 1000, record, 2, true, JOB_PROGRAM);
+    schedule_job(now + 1000, record, 3, true, JOB_BACKGROUND);
+    TEST_ASSERT_EQUAL(2, preempt_jobs(JOB_MANUAL, 0));
+    TEST_ASSERT_EQUAL(1, jobs_pending());
+    runFor(2000, 100);
+    TEST_ASSERT_EQUAL(1, numDispatched);
+    TEST_ASSERT_EQUAL(1, dispatched[0].relay);
+}
+
+
+// a manual command must not leave a valve opened by a program open
+void test_preempt_keeps_close_job() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now, record, 1, true, JOB_PROGRAM);
+    schedule_job(now + 60000, record, 1, false, JOB_PROGRAM);
+    schedule_job(now + 65000, record, 2, true, JOB_PROGRAM);
+    schedule_job(now + 125000, record, 2, false, JOB_PROGRAM);
+    schedule_job(now + 130000, record, 1, true, JOB_PROGRAM);  // second run
+    schedule_job(now + 190000, record, 1, false, JOB_PROGRAM);
+    runFor(1000, 100);
+    TEST_ASSERT_EQUAL(1, numDispatched);
+
+    // valve 1 is open, only its next close job survives
+    TEST_ASSERT_EQUAL(4, preempt_jobs(JOB_MANUAL, 1UL << 1));
+    TEST_ASSERT_EQUAL(1, jobs_pending());
+    runFor(200000, 1000);
+    TEST_ASSERT_EQUAL(2, numDispatched);
+    TEST_ASSERT_EQUAL(1, dispatched[1].relay);
+    TEST_ASSERT_FALSE(dispatched[1].state);
+    TEST_ASSERT_EQUAL(now + 60000, dispatched[1].time);
+}
+
+
+// safety stop drops close jobs as well, relays are switched off directly
+void test_safety_drops_close_jobs() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 60000, record, 1, false, JOB_PROGRAM);
+    schedule_job(now + 60000, record, 2, false, JOB_MANUAL);
+    TEST_ASSERT_EQUAL(2, preempt_jobs(JOB_SAFETY, 0));
+    TEST_ASSERT_FALSE(jobs_scheduled());
+    runFor(61000, 1000);
+    TEST_ASSERT_EQUAL(0, numDispatched);
+}
+
+
+// pump handover only waits for a valve opening soon, not for
+// a close job or tomorrow's program
+void test_jobs_due() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 3000, record, 1, false, JOB_PROGRAM);
+    schedule_job(now + 86400000ULL, record, 2, true, JOB_PROGRAM);
+    TEST_ASSERT_FALSE(jobs_due(now + 10000, true));
+    TEST_ASSERT_TRUE(jobs_due(now + 10000, false));
+    TEST_ASSERT_TRUE(jobs_due(now + 86400000ULL, true));
+    schedule_job(now + 5000, record, 3, true, JOB_PROGRAM);
+    TEST_ASSERT_TRUE(jobs_due(now + 10000, true));
+    preempt_jobs(JOB_MANUAL, 0);
+    TEST_ASSERT_FALSE(jobs_due(now + 86400000ULL, true));
+}
+
+
+// a preempted job must never come back to life, even after
+// its class has been preempted more than 2^16 times
+void test_epoch_no_wrap() {
+    uint64_t now = getUptimeMillis();
+
+    schedule_job(now + 1000, record, 1, true, JOB_PROGRAM);
+    for (uint32_t i = 0; i < 0x10000; i++)
+        preempt_jobs(JOB_MANUAL, 0);
+    runFor(2000, 100);
+    TEST_ASSERT_EQUAL(0, numDispatched);
+}
+
+
+// a short list (e.g. the reset journal) keeps the earliest due
+// jobs in order, no matter in which pool slots they are
+void test_list_earliest() {
+    uint64_t now = getUptimeMillis();
+    valvejob_t jobs[4];
+
+    for (uint8_t i = MAX_JOBS; i > 0; i--)  // fills pool backwards
+        schedule_job(now + i * 1000, record, i, i > 1, JOB_PROGRAM);
+    preempt_jobs(JOB_MANUAL, 1UL << 1);  // only keeps close job of relay 1
+    schedule_job(now + 2500, record, 3, true, JOB_MANUAL);
+    schedule_job(now + 1500, record, 2, true, JOB_PROGRAM);
+    schedule_job(now + 500, record, 4, true, JOB_MANUAL);
+    TEST_ASSERT_EQUAL(4, jobs_list(jobs, 4));
+    TEST_ASSERT_EQUAL(now + 500, jobs[0].time);
+    TEST_ASSERT_EQUAL(now + 1000, jobs[1].time);
+    TEST_ASSERT_EQUAL(now + 1500, jobs[2].time);
+    TEST_ASSERT_EQUAL(now + 2500, jobs[3].time);
+    TEST_ASSERT_EQUAL(4, jobs_list(jobs, 8));
+}
+
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_deadline_order);
+    RUN_TEST(test_stale_handles);
+    RUN_TEST(test_preempt_lower_classes);
+    RUN_TEST(test_preempt_keeps_close_job);
+    RUN_TEST(test_safety_drops_close_jobs);
+    RUN_TEST(test_jobs_due);
+    RUN_TEST(test_epoch_no_wrap);
+    RUN_TEST(test_list_earliest);
+    return UNITY_END();
+}
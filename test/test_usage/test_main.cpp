@@ -0,0 +1,90 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// water usage accounting: run time per valve, volume only
+// from measured flow rates, daily buckets
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "relay.h"
+#include "usage.h"
+
+static char json[USAGE_STATUS_SIZE];
+
+
+// counters survive like in RTC memory, each test starts on a new day
+void setUp() {
+    halAdvance(86400000UL);
+    for (uint8_t i = 0; i < NUM_RELAY; i++) {
+        switchesPrefs.rateRelay[i] = 0;
+        switchesPrefs.flowRelay[i] = 10;  // pump share, not a measured rate
+    }
+}
+
+
+void tearDown() {
+}
+
+
+void test_liters_from_rate() {
+    switchesPrefs.rateRelay[0] = 12;
+    switchesPrefs.rateRelay[1] = 6;
+    usageAdd(1, 60000);
+    usageAdd(2, 30000);
+    TEST_ASSERT_GREATER_THAN(0, usageStatus(json, sizeof(json)));
+    TEST_ASSERT_TRUE(strstr(json, "\"today\":{\"all\":[90,15],\"valve1\":[60,12],\"valve2\":[30,3],\"valve3\":[0,null]"));
+}
+
+
+// no volume is made up from the pump share of a valve
+void test_seconds_only_without_rate() {
+    switchesPrefs.rateRelay[0] = 12;
+    usageAdd(1, 60000);
+    usageAdd(3, 120000);
+    TEST_ASSERT_GREATER_THAN(0, usageStatus(json, sizeof(json)));
+    TEST_ASSERT_TRUE(strstr(json, "\"today\":{\"all\":[180,null],\"valve1\":[60,12],\"valve2\":[0,null],\"valve3\":[120,null]"));
+}
+
+
+void test_new_day() {
+    switchesPrefs.rateRelay[0] = 10;
+    usageAdd(1, 60000);
+    halAdvance(86400000UL);
+    usageAdd(1, 30000);
+    TEST_ASSERT_GREATER_THAN(0, usageStatus(json, sizeof(json)));
+    TEST_ASSERT_TRUE(strstr(json, "\"today\":{\"all\":[30,5],\"valve1\":[30,5]"));
+}
+
+
+int main(int argc, char** argv) {
+    initPrefs();  // valve defaults from config.h
+    halSetTime(1782900000);  // 01/07/2026 10:00 UTC
+    initUsage();
+    initRelays();  // valve names
+
+    UNITY_BEGIN();
+    RUN_TEST(test_liters_from_rate);
+    RUN_TEST(test_seconds_only_without_rate);
+    RUN_TEST(test_new_day);
+    return UNITY_END();
+}
@@ -0,0 +1,195 @@
+/***************************************************************************
+  Copyright (c) 2021-2022 Lars Wessels
+
+  This file a part of the "ESP32-Irrigation-Automation" source code.
+  https://github.com/lrswss/esp32-irrigation-automation
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+   
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+***************************************************************************/
+
+// runs irrigation programs, scheduler and relays for a year on the
+// virtual clock of the host HAL; crosses both DST changes and seven
+// wraparounds of millis(), the program start times must still match
+// their local start times and every valve run its configured time
+
+#include <unity.h>
+#include "firmware_stubs.h"
+#include "config.h"
+#include "hal.h"
+#include "rtc.h"
+#include "relay.h"
+#include "programs.h"
+#include "scheduler.h"
+
+#define SIM_START 1767225600  // 01/01/2026 00:00 UTC
+#define SIM_DAYS 365
+#define SIM_STEP_MS 250  // main loop cadence while valves are busy
+#define SIM_START_SLACK 1  // secs, programs are checked once per second
+
+static uint32_t opens[NUM_RELAY + 1][SIM_DAYS + 1];  // per local day
+static uint64_t openedAt[NUM_RELAY + 1];
+static uint32_t runSecs[NUM_RELAY + 1];
+static int32_t startOffset[NUM_RELAY + 1];  // secs after local start time
+static uint32_t violations, wraps, badRuns, lateStarts;
+
+
+static void setProgram(uint8_t prog, uint8_t weekdays, int16_t start, uint8_t relay, uint16_t secs) {
+    irrigationProgram_t* p = &switchesPrefs.irrigationPrograms[prog];
+
+    memset(p, 0, sizeof(irrigationProgram_t));
+    p->enabled = true;
+    p->weekdays = weekdays;
+    p->starts[0] = start;
+    for (uint8_t i = 1; i < MAX_PROGRAM_STARTS; i++)
+        p->starts[i] = -1;
+    p->secs[relay-1] = secs;
+    runSecs[relay] = secs;
+    startOffset[relay] = start * 60;
+}
+
+
+// local day since start of simulation
+static uint16_t simDay() {
+    return (getLocalTime() - utcToLocal(SIM_START)) / 86400;
+}
+
+
+// track valve transitions after each main loop pass
+static void observe() {
+    static relaystate_t prev[NUM_RELAY + 1];
+    static uint32_t prevMillis = 0;
+    time_t midnight;
+    int32_t offset;
+
+    if (millis() < prevMillis)
+        wraps++;
+    prevMillis = millis();
+
+    if (!checkInterlocks())
+        violations++;
+
+    for (uint8_t i = 1; i <= NUM_RELAY; i++) {
+        if (relaystate[i] == RELAY_ON && prev[i] != RELAY_ON) {
+            openedAt[i] = getUptimeMillis();
+            opens[i][simDay()]++;
+            // a start within the hour skipped in spring runs an hour
+            // early, local times convert as in Timezone::toUTC()
+            midnight = getLocalTime() - getLocalTime() % 86400;
+            offset = getUTCTime() - localToUTC(midnight + startOffset[i]);
+            if (offset < 0 || offset > SIM_START_SLACK)
+                lateStarts++;
+        } else if (relaystate[i] != RELAY_ON && prev[i] == RELAY_ON) {
+            if ((getUptimeMillis() - openedAt[i]) / 1000 != runSecs[i])
+                badRuns++;
+        }
+        prev[i] = relaystate[i];
+    }
+}
+
+
+// one pass of the firmware main loop
+static void mainLoop() {
+    static uint64_t prevLoopTimer = 0;
+
+    if (getUptimeMillis() - prevLoopTimer >= 1000) {
+        prevLoopTimer = getUptimeMillis();
+        programScheduler();
+        unblockRelays();
+        pumpAutoStop();
+    }
+    pumpMonitor();
+    relayCommands();
+    scheduler();
+    logRelayEvents();
+    observe();
+}
+
+
+// idle time is skipped up to the next program start
+static void simulate(time_t until) {
+    time_t now, next;
+
+    while ((now = getUTCTime()) < until) {
+        if (jobs_scheduled() || relaysOpen() || relaystate[0] == RELAY_ON) {
+            halAdvance(SIM_STEP_MS);
+        } else {
+            next = min(now + 3600, until);
+            for (uint8_t p = 0; p < MAX_PROGRAMS; p++) {
+                if (nextProgramStart(p) > now && nextProgramStart(p) < next)
+                    next = nextProgramStart(p);
+            }
+            halAdvance((next - now) * 1000);
+        }
+        mainLoop();
+    }
+}
+
+
+void setUp() {
+}
+
+
+void tearDown() {
+}
+
+
+void test_year() {
+    uint32_t days[8] = { 0 };
+    uint8_t weekday;
+
+    // first wraparound of millis() half an hour after start
+    halAdvance(0xFFFFFFFFUL - 1800000UL);
+    halSetTime(SIM_START);
+
+    switchesPrefs.enableAutoIrrigation = true;
+    switchesPrefs.autoIrrigationPauseHours = 0;
+    switchesPrefs.relaysBlockMins = 60;
+    switchesPrefs.pumpAutoStopSecs = 600;
+    switchesPrefs.pumpCapacity = 0;
+    setProgram(0, 0x7F, 6 * 60, 1, 60);  // daily 06:00
+    setProgram(1, 0x7F, 2 * 60 + 30, 2, 30);  // daily 02:30, skipped/doubled by DST
+    setProgram(2, 0x12, 21 * 60 + 30, 3, 120);  // monday and thursday 21:30
+    setProgram(3, 0x7F, 6 * 60, 4, 0);
+    switchesPrefs.irrigationPrograms[3].enabled = false;
+
+    initRelays();
+    updatePrograms();
+    simulate(SIM_START + SIM_DAYS * 86400L);
+
+    TEST_ASSERT_EQUAL(0, violations);
+    TEST_ASSERT_EQUAL(0, badRuns);
+    TEST_ASSERT_EQUAL(0, lateStarts);
+    TEST_ASSERT_GREATER_OR_EQUAL(7, wraps);
+    TEST_ASSERT_LESS_OR_EQUAL(SIM_STEP_MS, schedulerStats.maxMillis);
+
+    // every program ran exactly once on each of its days
+    for (uint16_t d = 0; d < SIM_DAYS; d++) {
+        weekday = (utcToLocal(SIM_START) / 86400 + d + 4) % 7;
+        TEST_ASSERT_EQUAL_MESSAGE(1, opens[1][d], "daily 06:00");
+        TEST_ASSERT_EQUAL_MESSAGE(1, opens[2][d], "daily 02:30");
+        TEST_ASSERT_EQUAL_MESSAGE((0x12 & (1 << weekday)) ? 1 : 0, opens[3][d], "weekly");
+        TEST_ASSERT_EQUAL(0, opens[4][d]);
+        days[weekday] += opens[3][d];
+    }
+    TEST_ASSERT_EQUAL(52, days[1]);  // mondays
+    TEST_ASSERT_EQUAL(53, days[4]);  // thursdays, 2026 starts on one
+}
+
+
+int main(int argc, char** argv) {
+    initPrefs();  // valve defaults from config.h
+    UNITY_BEGIN();
+    RUN_TEST(test_year);
+    return UNITY_END();
+}